@@ -0,0 +1,156 @@
+/*
+  ==============================================================================
+
+    The cascade in double precision, for offline renders.
+
+  ==============================================================================
+*/
+
+#include "DoubleCascade.h"
+
+size_t DoubleCascade::getArenaSize(int numChannels) noexcept
+{
+    return InstanceArena::getSize<ChannelStates>(static_cast<size_t>(juce::jmax(1, numChannels)));
+}
+
+void DoubleCascade::prepare(int numChannels, InstanceArena& arena)
+{
+    channelStates = arena.allocate<ChannelStates>(static_cast<size_t>(juce::jmax(1, numChannels)));
+}
+
+void DoubleCascade::reset() noexcept
+{
+    for(auto& states : channelStates)
+        states = {};
+}
+
+int DoubleCascade::getLane(int channel) const noexcept
+{
+    return channelStates.size() == 2 && stereoMode != Stereo_Linked ? channel : 0;
+}
+
+void DoubleCascade::clearState(int lane, int state) noexcept
+{
+    for(size_t ch = 0; ch < channelStates.size(); ++ch)
+        if(getLane(static_cast<int>(ch)) == lane)
+            channelStates[ch][static_cast<size_t>(state)] = {};
+}
+
+void DoubleCascade::setLayout(const ChainCoefficients& coefficients) noexcept
+{
+    auto assign = [](Section& section, const BiquadCoefficients& c, int state)
+    {
+        section = { c.b0, c.b1, c.b2, c.a1, c.a2, state };
+    };
+
+    // Cut stages that have just started running start from silence. Cuts on both channels
+    // run on left and right, so a new stereo mode doesn't disturb them.
+    for(int c = 0; c < 2; ++c)
+    {
+        auto& cut = cuts[static_cast<size_t>(c)];
+        const auto& source = c == 0 ? coefficients.lowCut : coefficients.highCut;
+        auto numStages = c == 0 ? coefficients.numLowCutSections : coefficients.numHighCutSections;
+        if(! coefficients.isCutShared(c))
+            numStages = 0;
+        const auto firstState = c == 0 ? lowCutState : highCutState;
+
+        for(int i = cut.numSections; i < numStages; ++i)
+            for(auto& states : channelStates)
+                states[static_cast<size_t>(firstState + i)] = {};
+
+        for(int i = 0; i < numStages; ++i)
+            assign(cut.sections[static_cast<size_t>(i)], source[static_cast<size_t>(i)], firstState + i);
+        cut.numSections = numStages;
+    }
+
+    // The same rules as StereoCascade for the bands and for cuts on one lane alone.
+    const bool stereoModeChanged = stereoMode != coefficients.stereoMode;
+    stereoMode = coefficients.stereoMode;
+
+    for(int l = 0; l < StereoCascade::numLanes; ++l)
+    {
+        auto& lane = lanes[static_cast<size_t>(l)];
+
+        std::array<bool, numStates> wasRunning {};
+        for(int i = 0; i < lane.numSections; ++i)
+            wasRunning[static_cast<size_t>(lane.sections[static_cast<size_t>(i)].state)] = true;
+
+        lane.numSections = 0;
+        auto add = [&](const BiquadCoefficients& c, int state, bool shapeChanged)
+        {
+            assign(lane.sections[static_cast<size_t>(lane.numSections++)], c, state);
+
+            if(! wasRunning[static_cast<size_t>(state)] || stereoModeChanged || shapeChanged)
+                clearState(l, state);
+        };
+
+        auto addCut = [&](int c)
+        {
+            if(coefficients.isCutShared(c) || ! coefficients.cutChannels[static_cast<size_t>(c)][static_cast<size_t>(l)])
+                return;
+
+            const auto& source = c == 0 ? coefficients.lowCut : coefficients.highCut;
+            const auto numStages = c == 0 ? coefficients.numLowCutSections : coefficients.numHighCutSections;
+            for(int i = 0; i < numStages; ++i)
+                add(source[static_cast<size_t>(i)], (c == 0 ? lowCutState : highCutState) + i, false);
+        };
+
+        addCut(0);
+        for(int i = 0; i < coefficients.numActiveBands[static_cast<size_t>(l)]; ++i)
+        {
+            auto band = static_cast<size_t>(coefficients.activeBands[static_cast<size_t>(l)][static_cast<size_t>(i)]);
+            add(coefficients.bands[band], bandState + static_cast<int>(band), bandTypes[band] != coefficients.bandTypes[band]);
+        }
+        addCut(1);
+    }
+
+    bandTypes = coefficients.bandTypes;
+}
+
+double DoubleCascade::run(const Sections& sections, ChannelStates& states, double x) noexcept
+{
+    for(int i = 0; i < sections.numSections; ++i)
+    {
+        const auto& c = sections.sections[static_cast<size_t>(i)];
+        auto& s = states[static_cast<size_t>(c.state)];
+        auto y = c.b0 * x + s[0];
+        s[0] = c.b1 * x - c.a1 * y + s[1];
+        s[1] = c.b2 * x - c.a2 * y;
+        x = y;
+    }
+    return x;
+}
+
+void DoubleCascade::process(float* const* channels, int numChannels, int numSamples) noexcept
+{
+    numChannels = juce::jmin(numChannels, static_cast<int>(channelStates.size()));
+
+    if(numChannels == 2 && stereoMode != Stereo_Linked)
+    {
+        const bool midSide = stereoMode == Stereo_MidSide;
+        auto& leftStates = channelStates[0];
+        auto& rightStates = channelStates[1];
+
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto left = run(cuts[0], leftStates, channels[0][i]);
+            auto right = run(cuts[0], rightStates, channels[1][i]);
+
+            auto a = run(lanes[0], leftStates, midSide ? 0.5 * (left + right) : left);
+            auto b = run(lanes[1], rightStates, midSide ? 0.5 * (left - right) : right);
+
+            channels[0][i] = static_cast<float>(run(cuts[1], leftStates, midSide ? a + b : a));
+            channels[1][i] = static_cast<float>(run(cuts[1], rightStates, midSide ? a - b : b));
+        }
+        return;
+    }
+
+    for(int ch = 0; ch < numChannels; ++ch)
+    {
+        auto& states = channelStates[static_cast<size_t>(ch)];
+        auto* data = channels[ch];
+
+        for(int i = 0; i < numSamples; ++i)
+            data[i] = static_cast<float>(run(cuts[1], states, run(lanes[0], states, run(cuts[0], states, data[i]))));
+    }
+}
@@ -0,0 +1,76 @@
+/*
+  ==============================================================================
+
+    The cascade in double precision, for offline renders.
+
+    Runs the same sections as StereoCascade, in the same order, one sample at
+    a time through a transposed direct form II with every state and product
+    in double. The coefficients are the float ones the live path runs, so the
+    response is identical; only the rounding differs. In float that rounding
+    noise rises for low cut-offs at high sample rates, where the poles crowd
+    towards z = 1, while in double it stays far below anything a 24 bit file
+    can hold. It costs a few times what the float cascade does, which doesn't
+    matter when nothing is waiting on the audio device.
+
+    Nothing here adds latency, so switching to it changes nothing the host's
+    delay compensation depends on.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+class DoubleCascade
+{
+public:
+    // The arena space prepare() takes for a bus of numChannels channels.
+    static size_t getArenaSize(int numChannels) noexcept;
+
+    // Carves the states for a bus of numChannels channels from arena. Not real-time safe.
+    void prepare(int numChannels, InstanceArena& arena);
+    void reset() noexcept;
+
+    // As StereoCascade::setLayout, a section that keeps running keeps its state and one
+    // that has just started running starts from silence.
+    void setLayout(const ChainCoefficients& coefficients) noexcept;
+
+    // Filters the first numChannels channels in place, up to the number prepared.
+    void process(float* const* channels, int numChannels, int numSamples) noexcept;
+
+private:
+    enum
+    {
+        lowCutState = 0,
+        bandState = lowCutState + maxCutSections,
+        highCutState = bandState + maxBands,
+        numStates = highCutState + maxCutSections
+    };
+
+    struct Section
+    {
+        double b0, b1, b2, a1, a2;
+        int state;
+    };
+
+    struct Sections
+    {
+        std::array<Section, maxChainSections> sections;
+        int numSections = 0;
+    };
+
+    using ChannelStates = std::array<std::array<double, 2>, numStates>;
+
+    static double run(const Sections& sections, ChannelStates& states, double x) noexcept;
+    int getLane(int channel) const noexcept;
+    void clearState(int lane, int state) noexcept;
+
+    std::array<Sections, 2> cuts;                           // low, high; when on left and right
+    std::array<Sections, StereoCascade::numLanes> lanes;    // the bands, and cuts on one lane alone
+    ArenaArray<ChannelStates> channelStates;
+
+    std::array<BandType, maxBands> bandTypes {};
+    StereoMode stereoMode { Stereo_Linked };
+};
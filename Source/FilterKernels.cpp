@@ -0,0 +1,396 @@
+/*
+  ==============================================================================
+
+    Biquad kernels for the EQ bands.
+
+  ==============================================================================
+*/
+
+#include "FilterKernels.h"
+
+const juce::StringArray& getBandTypeNames()
+{
+    static const juce::StringArray names { "Peak", "Low Shelf", "High Shelf", "Notch", "Band Pass", "Tilt", "All Pass" };
+    return names;
+}
+
+const juce::StringArray& getDesignMethodNames()
+{
+    static const juce::StringArray names { "Bilinear", "Matched" };
+    return names;
+}
+
+static BiquadCoefficients makeCoefficients(double b0, double b1, double b2, double a1, double a2)
+{
+    BiquadCoefficients c;
+    c.b0 = static_cast<float>(b0);
+    c.b1 = static_cast<float>(b1);
+    c.b2 = static_cast<float>(b2);
+    c.a1 = static_cast<float>(a1);
+    c.a2 = static_cast<float>(a2);
+    return c;
+}
+
+// Frequencies are clamped just below Nyquist, where the bilinear designs fall apart.
+static double getNormalisedFrequency(double freq, double sampleRate)
+{
+    return juce::MathConstants<double>::twoPi * juce::jmin(freq, sampleRate * 0.499) / sampleRate;
+}
+
+static BiquadCoefficients makeBilinearCoefficients(BandType type, double freq, double quality, double gainInDecibels, double sampleRate)
+{
+    // RBJ cookbook designs, matching juce::dsp::IIR::Coefficients for the shapes JUCE has.
+    const auto w0 = getNormalisedFrequency(freq, sampleRate);
+    const auto cosw0 = std::cos(w0);
+    const auto alpha = std::sin(w0) / (2.0 * quality);
+    const auto A = std::pow(10.0, gainInDecibels / 40.0);
+
+    double b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+
+    switch(type)
+    {
+        case Peak:
+        {
+            b0 = 1.0 + alpha * A;
+            b1 = -2.0 * cosw0;
+            b2 = 1.0 - alpha * A;
+            a0 = 1.0 + alpha / A;
+            a1 = -2.0 * cosw0;
+            a2 = 1.0 - alpha / A;
+            break;
+        }
+
+        case LowShelf:
+        case HighShelf:
+        {
+            const auto aminus1 = A - 1.0;
+            const auto aplus1 = A + 1.0;
+            const auto beta = std::sin(w0) * std::sqrt(A) / quality;
+            const auto sign = type == LowShelf ? 1.0 : -1.0;
+
+            b0 = A * (aplus1 - sign * aminus1 * cosw0 + beta);
+            b1 = sign * 2.0 * A * (aminus1 - sign * aplus1 * cosw0);
+            b2 = A * (aplus1 - sign * aminus1 * cosw0 - beta);
+            a0 = aplus1 + sign * aminus1 * cosw0 + beta;
+            a1 = -sign * 2.0 * (aminus1 + sign * aplus1 * cosw0);
+            a2 = aplus1 + sign * aminus1 * cosw0 - beta;
+            break;
+        }
+
+        case Notch:
+        {
+            b0 = 1.0;
+            b1 = -2.0 * cosw0;
+            b2 = 1.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosw0;
+            a2 = 1.0 - alpha;
+            break;
+        }
+
+        case BandPass:
+        {
+            b0 = alpha;
+            b1 = 0.0;
+            b2 = -alpha;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosw0;
+            a2 = 1.0 - alpha;
+            break;
+        }
+
+        case Tilt:
+        {
+            // First order shelf pivoting around freq: -gain/2 at DC, +gain/2 at Nyquist.
+            const auto g = std::pow(10.0, gainInDecibels / 40.0);
+            const auto k = std::tan(w0 * 0.5);
+            b0 = g + k;
+            b1 = k - g;
+            a0 = 1.0 + g * k;
+            a1 = g * k - 1.0;
+            break;
+        }
+
+        case AllPass:
+        {
+            b0 = 1.0 - alpha;
+            b1 = -2.0 * cosw0;
+            b2 = 1.0 + alpha;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosw0;
+            a2 = 1.0 - alpha;
+            break;
+        }
+
+        case NumBandTypes:
+            jassertfalse;
+            break;
+    }
+
+    return makeCoefficients(b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0);
+}
+
+//==============================================================================
+namespace
+{
+    // H(s) = (n2 s^2 + n1 s + n0) / (d2 s^2 + d1 s + d0), with s in radians per sample.
+    struct AnalogPrototype
+    {
+        double n2, n1, n0, d2, d1, d0;
+
+        double getMagnitudeSquared(double w) const noexcept
+        {
+            const auto w2 = w * w;
+            return (juce::square(n0 - n2 * w2) + juce::square(n1 * w))
+                 / (juce::square(d0 - d2 * w2) + juce::square(d1 * w));
+        }
+    };
+
+    // The impulse invariant poles: z = exp(s T) for both poles of the prototype.
+    void matchPoles(const AnalogPrototype& prototype, double& a1, double& a2)
+    {
+        const auto w = std::sqrt(prototype.d0 / prototype.d2);
+        const auto zeta = prototype.d1 / (2.0 * std::sqrt(prototype.d0 * prototype.d2));
+        const auto r = std::exp(-zeta * w);
+
+        a2 = r * r;
+        a1 = zeta <= 1.0 ? -2.0 * r * std::cos(w * std::sqrt(1.0 - zeta * zeta))
+                         : -2.0 * r * std::cosh(w * std::sqrt(zeta * zeta - 1.0));
+    }
+
+    struct MatchedBiquad
+    {
+        double b0, b1, b2, a1, a2;
+
+        BiquadCoefficients toCoefficients() const { return makeCoefficients(b0, b1, b2, a1, a2); }
+    };
+
+    // In phi = sin^2(w / 2) the squared magnitude of a biquad is
+    // (B0 (1 - phi) + B1 phi + B2 p) / (A0 (1 - phi) + A1 phi + A2 p), p = 4 phi (1 - phi),
+    // with B0 = (b0 + b1 + b2)^2, B1 = (b0 - b1 + b2)^2 and B2 = -4 b0 b2 (likewise for A).
+    // B0 and B1 fix DC and Nyquist, B2 then fixes the match frequency.
+    MatchedBiquad matchBiquad(const AnalogPrototype& prototype, double matchW)
+    {
+        double a1, a2;
+        matchPoles(prototype, a1, a2);
+
+        const auto A0 = juce::square(1.0 + a1 + a2), A1 = juce::square(1.0 - a1 + a2), A2 = -4.0 * a2;
+        const auto phi1 = juce::square(std::sin(matchW * 0.5)), phi0 = 1.0 - phi1, phi2 = 4.0 * phi0 * phi1;
+
+        const auto B0 = A0 * prototype.getMagnitudeSquared(0.0);
+        const auto B1 = A1 * prototype.getMagnitudeSquared(juce::MathConstants<double>::pi);
+        const auto B2 = (prototype.getMagnitudeSquared(matchW) * (A0 * phi0 + A1 * phi1 + A2 * phi2)
+                         - B0 * phi0 - B1 * phi1) / phi2;
+
+        const auto sqrtB0 = std::sqrt(B0), sqrtB1 = std::sqrt(B1);
+        const auto W = 0.5 * (sqrtB0 + sqrtB1);
+        const auto b1 = 0.5 * (sqrtB0 - sqrtB1);
+
+        // When the zeros can't reach the target at matchW (W^2 + B2 < 0), keep DC and Nyquist
+        // and get as close as real zeros allow.
+        if(W * W + B2 < 0.0)
+            return { 0.5 * W, b1, 0.5 * W, a1, a2 };
+
+        const auto b0 = 0.5 * (W + std::sqrt(W * W + B2));
+        return { b0, b1, -B2 / (4.0 * b0), a1, a2 };
+    }
+
+    BiquadCoefficients makeMatchedCoefficients(const AnalogPrototype& prototype, double matchW)
+    {
+        return matchBiquad(prototype, matchW).toCoefficients();
+    }
+
+    // A shelf's poles sit a factor sqrt(A) above its zeros for a high shelf boost or a low
+    // shelf cut, which near Nyquist puts them beyond the reach of impulse invariance. Those
+    // are designed as the inverse filter, whose poles are the lower pair, and inverted; the
+    // larger root chosen for b0 keeps the inverse's zeros, the new poles, inside the unit circle.
+    BiquadCoefficients makeMatchedShelfCoefficients(const AnalogPrototype& prototype, double matchW)
+    {
+        if(prototype.d0 * prototype.n2 <= prototype.n0 * prototype.d2)
+            return makeMatchedCoefficients(prototype, matchW);
+
+        auto inverse = matchBiquad({ prototype.d2, prototype.d1, prototype.d0,
+                                     prototype.n2, prototype.n1, prototype.n0 }, matchW);
+        return makeCoefficients(1.0 / inverse.b0, inverse.a1 / inverse.b0, inverse.a2 / inverse.b0,
+                                inverse.b1 / inverse.b0, inverse.b2 / inverse.b0);
+    }
+
+    // The matched design's phi at the match frequency must stay clear of Nyquist, where B2
+    // is no longer determined.
+    double getMatchFrequency(double w)
+    {
+        return juce::jmin(w, 0.9 * juce::MathConstants<double>::pi);
+    }
+
+    BiquadCoefficients makeMatchedBandCoefficients(BandType type, double freq, double quality,
+                                                   double gainInDecibels, double sampleRate)
+    {
+        const auto w = getNormalisedFrequency(freq, sampleRate);
+        const auto matchW = getMatchFrequency(w);
+        const auto A = std::pow(10.0, gainInDecibels / 40.0);
+        const auto sqrtA = std::sqrt(A);
+
+        switch(type)
+        {
+            case Peak:
+                return makeMatchedCoefficients({ 1.0, A * w / quality, w * w, 1.0, w / (A * quality), w * w }, matchW);
+
+            case LowShelf:
+                return makeMatchedShelfCoefficients({ A, A * sqrtA * w / quality, A * A * w * w, A, sqrtA * w / quality, w * w }, matchW);
+
+            case HighShelf:
+                return makeMatchedShelfCoefficients({ A * A, A * sqrtA * w / quality, A * w * w, 1.0, sqrtA * w / quality, A * w * w }, matchW);
+
+            case BandPass:
+                return makeMatchedCoefficients({ 0.0, w / quality, 0.0, 1.0, w / quality, w * w }, matchW);
+
+            case Notch:
+            {
+                // The zeros stay on the unit circle at the notch, scaled for unity gain at DC.
+                double a1, a2;
+                matchPoles({ 1.0, 0.0, w * w, 1.0, w / quality, w * w }, a1, a2);
+                const auto g = (1.0 + a1 + a2) / (2.0 - 2.0 * std::cos(w));
+                return makeCoefficients(g, -2.0 * g * std::cos(w), g, a1, a2);
+            }
+
+            case AllPass:
+            {
+                double a1, a2;
+                matchPoles({ 1.0, -w / quality, w * w, 1.0, w / quality, w * w }, a1, a2);
+                return makeCoefficients(a2, a1, 1.0, a1, a2);
+            }
+
+            case Tilt:
+            {
+                // H(s) = (g s + w) / (s + g w): the pole is matched, the zero fixes DC and Nyquist.
+                const auto g = A;
+                const auto pi = juce::MathConstants<double>::pi;
+                const auto a1 = -std::exp(-g * w);
+                const auto dc = (1.0 + a1) / g;
+                const auto nyquist = (1.0 - a1) * std::sqrt((g * g * pi * pi + w * w) / (pi * pi + g * g * w * w));
+                return makeCoefficients(0.5 * (dc + nyquist), 0.5 * (dc - nyquist), 0.0, a1, 0.0);
+            }
+
+            case NumBandTypes:
+                break;
+        }
+
+        jassertfalse;
+        return {};
+    }
+}
+
+BiquadCoefficients makeBandCoefficients(BandType type, double freq, double quality, double gainInDecibels,
+                                        double sampleRate, DesignMethod method)
+{
+    return method == Design_Matched ? makeMatchedBandCoefficients(type, freq, quality, gainInDecibels, sampleRate)
+                                    : makeBilinearCoefficients(type, freq, quality, gainInDecibels, sampleRate);
+}
+
+BandType getKernelType(BandType type, DesignMethod method)
+{
+    if(method == Design_Matched && (type == Peak || type == Notch || type == BandPass))
+        return Biquad;
+
+    return type;
+}
+
+BiquadCoefficients makeCutCoefficients(bool highPass, double freq, double quality, double sampleRate, DesignMethod method)
+{
+    const auto w = getNormalisedFrequency(freq, sampleRate);
+
+    if(method == Design_Matched)
+    {
+        if(! highPass)
+            return makeMatchedCoefficients({ 0.0, 0.0, w * w, 1.0, w / quality, w * w }, getMatchFrequency(w));
+
+        // Both zeros stay at DC, so only the gain is left to match.
+        const AnalogPrototype prototype { 1.0, 0.0, 0.0, 1.0, w / quality, w * w };
+        double a1, a2;
+        matchPoles(prototype, a1, a2);
+
+        const auto matchW = getMatchFrequency(w);
+        const auto phi = juce::square(std::sin(matchW * 0.5));
+        const BiquadCoefficients poles { 1.f, 0.f, 0.f, static_cast<float>(a1), static_cast<float>(a2) };
+        const auto g = std::sqrt(prototype.getMagnitudeSquared(matchW) * getDenominatorMagnitudeSquared(poles, phi)) / (4.0 * phi);
+        return makeCoefficients(g, -2.0 * g, g, a1, a2);
+    }
+
+    // RBJ cookbook, as juce::dsp::IIR::Coefficients::makeLowPass / makeHighPass.
+    const auto cosw = std::cos(w);
+    const auto alpha = std::sin(w) / (2.0 * quality);
+    const auto a0 = 1.0 + alpha;
+    const auto b = highPass ? 0.5 * (1.0 + cosw) : 0.5 * (1.0 - cosw);
+    const auto sign = highPass ? -1.0 : 1.0;
+
+    return makeCoefficients(b / a0, sign * 2.0 * b / a0, b / a0, -2.0 * cosw / a0, (1.0 - alpha) / a0);
+}
+
+BlockCoefficients makeBlockCoefficients(const BiquadCoefficients& coefficients)
+{
+    constexpr int length = BlockCoefficients::blockLength;
+    const double b0 = coefficients.b0, b1 = coefficients.b1, b2 = coefficients.b2;
+    const double a1 = coefficients.a1, a2 = coefficients.a2;
+    
+    BlockCoefficients m {};
+    m.coefficients = coefficients;
+    
+    // Column k is the response to the k-th input alone: a unit state for the first two,
+    // a unit impulse at x[k - 2] for the rest.
+    for(int k = 0; k < BlockCoefficients::numInputs; ++k)
+    {
+        double s1 = k == 0 ? 1.0 : 0.0;
+        double s2 = k == 1 ? 1.0 : 0.0;
+        auto* column = m.columns[k];
+        
+        for(int n = 0; n < length; ++n)
+        {
+            double x = n == k - 2 ? 1.0 : 0.0;
+            double y = b0 * x + s1;
+            s1 = b1 * x - a1 * y + s2;
+            s2 = b2 * x - a2 * y;
+            column[n] = static_cast<float>(y);
+        }
+        
+        column[length] = static_cast<float>(s1);
+        column[length + 1] = static_cast<float>(s2);
+    }
+    
+    return m;
+}
+
+BandProcessFunction getBandProcessFunction(BandType type)
+{
+    static constexpr BandProcessFunction functions[NumBandTypes + 1]
+    {
+        &BandKernel<Peak>::process,
+        &BandKernel<LowShelf>::process,
+        &BandKernel<HighShelf>::process,
+        &BandKernel<Notch>::process,
+        &BandKernel<BandPass>::process,
+        &BandKernel<Tilt>::process,
+        &BandKernel<AllPass>::process,
+        &BandKernel<Biquad>::process
+    };
+
+    jassert(juce::isPositiveAndNotGreaterThan(type, Biquad));
+    return functions[type];
+}
+
+BandMagnitudeFunction getBandMagnitudeFunction(BandType type)
+{
+    static constexpr BandMagnitudeFunction functions[NumBandTypes + 1]
+    {
+        &BandKernel<Peak>::getMagnitudePolynomials,
+        &BandKernel<LowShelf>::getMagnitudePolynomials,
+        &BandKernel<HighShelf>::getMagnitudePolynomials,
+        &BandKernel<Notch>::getMagnitudePolynomials,
+        &BandKernel<BandPass>::getMagnitudePolynomials,
+        &BandKernel<Tilt>::getMagnitudePolynomials,
+        &BandKernel<AllPass>::getMagnitudePolynomials,
+        &BandKernel<Biquad>::getMagnitudePolynomials
+    };
+
+    jassert(juce::isPositiveAndNotGreaterThan(type, Biquad));
+    return functions[type];
+}
@@ -0,0 +1,29 @@
+/*
+  ==============================================================================
+
+    One aligned block of memory for an instance's audio path.
+
+  ==============================================================================
+*/
+
+#include "InstanceArena.h"
+
+void InstanceArena::reset(size_t numBytes)
+{
+    used = 0;
+
+    if(numBytes == size)
+        return;
+
+    block.free();
+    base = nullptr;
+    size = 0;
+
+    if(numBytes == 0)
+        return;
+
+    block.malloc(numBytes + alignment - 1);
+    const auto address = reinterpret_cast<std::uintptr_t>(block.get());
+    base = block.get() + ((alignment - address % alignment) % alignment);
+    size = numBytes;
+}
@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    One aligned block of memory for an instance's audio path.
+
+    Everything whose size depends on the bus or the block size (the
+    cascades' per-channel states, the block recursive coefficients and the
+    loudness meters' channel states) is carved from a single allocation that
+    prepareToPlay() sizes: it adds up what each engine asks for, reallocates
+    only when that total changes, and then lets each engine take its part in
+    turn. An instance's working set then sits in consecutive cache lines
+    instead of in a handful of separate heap blocks, and each part starts on
+    a cache line of its own, so pairs processed on different threads never
+    share one.
+
+    The arena never runs destructors, so it only holds trivially
+    destructible types, and whatever was carved from it is invalid once it
+    is reset.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// A view of count elements carved from an InstanceArena. Empty until then.
+template<typename T>
+class ArenaArray
+{
+public:
+    ArenaArray() = default;
+    ArenaArray(T* e, size_t count) noexcept : elements(e), numElements(count) {}
+
+    T* begin() const noexcept { return elements; }
+    T* end() const noexcept { return elements + numElements; }
+    T* data() const noexcept { return elements; }
+    size_t size() const noexcept { return numElements; }
+    bool empty() const noexcept { return numElements == 0; }
+
+    T& operator[](size_t index) const noexcept
+    {
+        jassert(index < numElements);
+        return elements[index];
+    }
+
+private:
+    T* elements = nullptr;
+    size_t numElements = 0;
+};
+
+class InstanceArena
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    // The space allocate<T>(count) takes, so the engines can say what they need up front.
+    template<typename T>
+    static constexpr size_t getSize(size_t count) noexcept
+    {
+        return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+    }
+
+    // Not real-time safe. Makes room for numBytes, reallocating only when that isn't what
+    // the arena already has, and starts carving from the beginning again.
+    void reset(size_t numBytes);
+
+    // count value-initialised Ts, starting on the next free cache line. Asserts and returns
+    // an empty array if the arena wasn't sized for them.
+    template<typename T>
+    ArenaArray<T> allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "the arena never destroys what it holds");
+        static_assert(alignof(T) <= alignment, "the arena only aligns to cache lines");
+
+        const auto numBytes = getSize<T>(count);
+        if(count == 0 || used + numBytes > size)
+        {
+            jassert(count == 0);
+            return {};
+        }
+
+        auto* elements = reinterpret_cast<T*>(base + used);
+        for(size_t i = 0; i < count; ++i)
+            new (elements + i) T();
+
+        used += numBytes;
+        return { elements, count };
+    }
+
+    // What the arena was sized for, what has been carved from it since the last reset,
+    // and what it really took from the heap, alignment slack included.
+    size_t getSize() const noexcept { return size; }
+    size_t getUsed() const noexcept { return used; }
+    size_t getAllocatedBytes() const noexcept { return size > 0 ? size + alignment - 1 : 0; }
+
+private:
+    juce::HeapBlock<char> block;
+    char* base = nullptr;
+    size_t size = 0, used = 0;
+};
@@ -0,0 +1,405 @@
+/*
+  ==============================================================================
+
+    Run-time instruction set dispatch for the vectorisable kernels.
+
+  ==============================================================================
+*/
+
+#include "KernelDispatch.h"
+
+namespace
+{
+    //==============================================================================
+    // The generic table: what the baseline build does anyway.
+    void processBlockRecursiveGeneric(const BlockCoefficients& m, BiquadState& state, float* data, int numSamples) noexcept
+    {
+        BlockRecursiveKernel::process(m, state, data, numSamples);
+    }
+
+    void multiplyMagnitudesGeneric(const MagnitudePolynomials& section, const double* phi,
+                                   double* magnitudesSquared, int numPoints) noexcept
+    {
+        for(int k = 0; k < numPoints; ++k)
+            magnitudesSquared[k] *= section.evaluate(phi[k]);
+    }
+
+    void applyWindowGeneric(float* dest, const float* source, const float* window, int numSamples) noexcept
+    {
+        juce::FloatVectorOperations::multiply(dest, source, window, numSamples);
+    }
+
+    void addPowersGeneric(double* sums, const float* magnitudes, int numBins) noexcept
+    {
+        for(int i = 0; i < numBins; ++i)
+            sums[i] += static_cast<double>(magnitudes[i]) * magnitudes[i];
+    }
+
+    constexpr KernelTable genericKernels { &processBlockRecursiveGeneric, &multiplyMagnitudesGeneric,
+                                           &applyWindowGeneric, &addPowersGeneric };
+
+   #if FIVEBANDEQ_KERNEL_VARIANTS
+    //==============================================================================
+    // The variants' kernels, written once over GCC/Clang vector types of any width. Nothing
+    // here takes or returns a vector, so the calling convention never depends on the target;
+    // each variant's entry points inline all of it (flatten) under their own target
+    // attribute, and that is what decides the instructions.
+    template<typename Floats, typename Doubles>
+    struct VectorKernels
+    {
+        static constexpr int numFloats = static_cast<int>(sizeof(Floats) / sizeof(float));
+        static constexpr int numDoubles = static_cast<int>(sizeof(Doubles) / sizeof(double));
+
+        // As many floats as Doubles has doubles.
+        typedef float HalfFloats __attribute__((vector_size(sizeof(Floats) / 2)));
+
+        // The same arithmetic as BlockRecursiveKernel, with each column in as few registers as
+        // the width allows: two for AVX2 (the outputs, then the new state), one for AVX-512.
+        static void processBlockRecursive(const BlockCoefficients& m, BiquadState& state, float* data, int numSamples) noexcept
+        {
+            constexpr int length = BlockCoefficients::blockLength;
+            constexpr int numRegisters = (BlockCoefficients::numOutputs + numFloats - 1) / numFloats;
+            static_assert(numRegisters * numFloats <= BlockCoefficients::columnSize, "the columns are too short");
+
+            auto s1 = state.s1, s2 = state.s2;
+            int i = 0;
+
+            for(; i + length <= numSamples; i += length)
+            {
+                auto* x = data + i;
+
+                // Unrolled by hand, as in BlockRecursiveKernel, so the registers never leave them.
+                // The inputs go first and the state last: only the state depends on the previous
+                // step, so the next step's inputs can start before this one has finished.
+                Floats v[numRegisters] {};
+                unroll([&](int n)
+                {
+                    const auto k = (n + 2) % BlockCoefficients::numInputs;
+                    const auto u = k == 0 ? s1 : k == 1 ? s2 : x[k - 2];
+
+                    // x[j] cannot reach the outputs before y[j], so skip the registers above the diagonal.
+                    for(int r = k < 2 ? 0 : (k - 2) / numFloats; r < numRegisters; ++r)
+                    {
+                        Floats c;
+                        std::memcpy(&c, m.columns[k] + r * numFloats, sizeof(Floats));
+                        v[r] += u * c;
+                    }
+                }, std::make_integer_sequence<int, BlockCoefficients::numInputs>());
+
+                std::memcpy(x, v, length * sizeof(float));
+                s1 = v[length / numFloats][length % numFloats];
+                s2 = v[(length + 1) / numFloats][(length + 1) % numFloats];
+            }
+
+            BiquadState tail { s1, s2 };
+            for(; i < numSamples; ++i)
+                data[i] = BandKernel<Biquad>::tick(m.coefficients, tail, data[i]);
+
+            state = tail;
+        }
+
+        static void multiplyMagnitudes(const MagnitudePolynomials& section, const double* phi,
+                                       double* magnitudesSquared, int numPoints) noexcept
+        {
+            int k = 0;
+            for(; k + numDoubles <= numPoints; k += numDoubles)
+            {
+                Doubles p, y;
+                std::memcpy(&p, phi + k, sizeof(Doubles));
+                std::memcpy(&y, magnitudesSquared + k, sizeof(Doubles));
+
+                y *= (section.n0 + (section.n1 + section.n2 * p) * p) / (section.d0 + (section.d1 + section.d2 * p) * p);
+                std::memcpy(magnitudesSquared + k, &y, sizeof(Doubles));
+            }
+
+            for(; k < numPoints; ++k)
+                magnitudesSquared[k] *= section.evaluate(phi[k]);
+        }
+
+        static void applyWindow(float* dest, const float* source, const float* window, int numSamples) noexcept
+        {
+            int i = 0;
+            for(; i + numFloats <= numSamples; i += numFloats)
+            {
+                Floats x, w;
+                std::memcpy(&x, source + i, sizeof(Floats));
+                std::memcpy(&w, window + i, sizeof(Floats));
+
+                x *= w;
+                std::memcpy(dest + i, &x, sizeof(Floats));
+            }
+
+            for(; i < numSamples; ++i)
+                dest[i] = source[i] * window[i];
+        }
+
+        static void addPowers(double* sums, const float* magnitudes, int numBins) noexcept
+        {
+            int i = 0;
+            for(; i + numDoubles <= numBins; i += numDoubles)
+            {
+                HalfFloats m;
+                std::memcpy(&m, magnitudes + i, sizeof(HalfFloats));
+                auto x = __builtin_convertvector(m, Doubles);
+
+                Doubles sum;
+                std::memcpy(&sum, sums + i, sizeof(Doubles));
+                sum += x * x;
+                std::memcpy(sums + i, &sum, sizeof(Doubles));
+            }
+
+            for(; i < numBins; ++i)
+                sums[i] += static_cast<double>(magnitudes[i]) * magnitudes[i];
+        }
+
+    private:
+        template<typename Function, int... I>
+        static void unroll(Function&& f, std::integer_sequence<int, I...>) noexcept
+        {
+            (f(I), ...);
+        }
+    };
+
+    #define FIVEBANDEQ_KERNEL_ENTRY_POINTS(targetName) \
+        __attribute__((target(targetName), flatten)) \
+        void processBlockRecursive(const BlockCoefficients& m, BiquadState& state, float* data, int numSamples) noexcept \
+        { \
+            Kernels::processBlockRecursive(m, state, data, numSamples); \
+        } \
+        \
+        __attribute__((target(targetName), flatten)) \
+        void multiplyMagnitudes(const MagnitudePolynomials& section, const double* phi, double* magnitudesSquared, int numPoints) noexcept \
+        { \
+            Kernels::multiplyMagnitudes(section, phi, magnitudesSquared, numPoints); \
+        } \
+        \
+        __attribute__((target(targetName), flatten)) \
+        void applyWindow(float* dest, const float* source, const float* window, int numSamples) noexcept \
+        { \
+            Kernels::applyWindow(dest, source, window, numSamples); \
+        } \
+        \
+        __attribute__((target(targetName), flatten)) \
+        void addPowers(double* sums, const float* magnitudes, int numBins) noexcept \
+        { \
+            Kernels::addPowers(sums, magnitudes, numBins); \
+        } \
+        \
+        constexpr KernelTable kernels { &processBlockRecursive, &multiplyMagnitudes, &applyWindow, &addPowers };
+
+    namespace avx2
+    {
+        typedef float Floats __attribute__((vector_size(32)));
+        typedef double Doubles __attribute__((vector_size(32)));
+        using Kernels = VectorKernels<Floats, Doubles>;
+
+        FIVEBANDEQ_KERNEL_ENTRY_POINTS("avx2,fma")
+    }
+
+    namespace avx512
+    {
+        typedef float Floats __attribute__((vector_size(64)));
+        typedef double Doubles __attribute__((vector_size(64)));
+        using Kernels = VectorKernels<Floats, Doubles>;
+
+        FIVEBANDEQ_KERNEL_ENTRY_POINTS("avx512f,avx2,fma")
+    }
+
+    #undef FIVEBANDEQ_KERNEL_ENTRY_POINTS
+   #endif
+
+    constexpr const KernelTable* kernelTables[NumKernelVariants]
+    {
+        &genericKernels,
+       #if FIVEBANDEQ_KERNEL_VARIANTS
+        &avx2::kernels,
+        &avx512::kernels
+       #else
+        nullptr,
+        nullptr
+       #endif
+    };
+
+    std::atomic<int>& getActiveVariant() noexcept
+    {
+        // Chosen on the first call, so the CPUID queries behind it only run once.
+        static std::atomic<int> variant { static_cast<int>(getBestKernelVariant()) };
+        return variant;
+    }
+}
+
+//==============================================================================
+const juce::StringArray& getKernelVariantNames()
+{
+    static const juce::StringArray names { "Generic", "AVX2", "AVX-512" };
+    return names;
+}
+
+bool isKernelVariantAvailable(KernelVariant variant)
+{
+    switch(variant)
+    {
+        case Kernels_Generic:
+            return true;
+
+       #if FIVEBANDEQ_KERNEL_VARIANTS
+        case Kernels_AVX2:
+            return juce::SystemStats::hasAVX2() && juce::SystemStats::hasFMA3();
+
+        case Kernels_AVX512:
+            return juce::SystemStats::hasAVX512F() && juce::SystemStats::hasAVX2() && juce::SystemStats::hasFMA3();
+       #endif
+
+        default:
+            return false;
+    }
+}
+
+KernelVariant getBestKernelVariant()
+{
+    for(int variant = NumKernelVariants - 1; variant > Kernels_Generic; --variant)
+        if(isKernelVariantAvailable(static_cast<KernelVariant>(variant)))
+            return static_cast<KernelVariant>(variant);
+
+    return Kernels_Generic;
+}
+
+const KernelTable& getKernels() noexcept
+{
+    return *kernelTables[getActiveVariant().load(std::memory_order_relaxed)];
+}
+
+const KernelTable& getKernels(KernelVariant variant)
+{
+    jassert(isKernelVariantAvailable(variant));
+    return *kernelTables[variant];
+}
+
+KernelVariant getActiveKernelVariant() noexcept
+{
+    return static_cast<KernelVariant>(getActiveVariant().load(std::memory_order_relaxed));
+}
+
+void setActiveKernelVariant(KernelVariant variant)
+{
+    jassert(isKernelVariantAvailable(variant));
+    getActiveVariant().store(variant, std::memory_order_relaxed);
+}
+
+//==============================================================================
+std::vector<KernelCheck> checkKernelVariants(juce::int64 seed)
+{
+    constexpr int numTrials = 256;
+    constexpr int maxLength = 1024;
+
+    // Fused multiply-adds round differently, and a sharp section's recursion amplifies that
+    // like any other rounding, so the block kernels can't be compared sample for sample: on
+    // any one trial either may come out several times closer to the double recursion. Over
+    // all of them a variant has to be about as close as the generic kernel.
+    constexpr double blockErrorRatio = 1.5;
+    constexpr double magnitudeToleranceInDecibels = 1.0e-6;
+    constexpr double spectrumTolerance = 1.0e-12;
+
+    const auto& generic = getKernels(Kernels_Generic);
+    std::vector<KernelCheck> checks;
+
+    for(int v = Kernels_Generic + 1; v < NumKernelVariants; ++v)
+    {
+        const auto variant = static_cast<KernelVariant>(v);
+        if(! isKernelVariantAvailable(variant))
+            continue;
+
+        const auto& kernels = getKernels(variant);
+        KernelCheck check { variant };
+
+        // Every variant sees the same inputs.
+        juce::Random random(seed);
+        double blockErrorEnergy = 0, genericBlockErrorEnergy = 0;
+
+        for(int trial = 0; trial < numTrials; ++trial)
+        {
+            // A random band at a random rate, over a length that doesn't end on a whole step
+            // or a whole register.
+            const auto sampleRate = 44100.0 * (1 << random.nextInt(3));
+            const auto type = static_cast<BandType>(random.nextInt(NumBandTypes));
+            const auto design = random.nextBool() ? Design_Matched : Design_Bilinear;
+            const auto section = makeBandCoefficients(type, 20.0 * std::pow(1000.0, random.nextDouble()),
+                                                      0.1 + 9.9 * random.nextDouble(), 48.0 * random.nextDouble() - 24.0,
+                                                      sampleRate, design);
+            const auto length = 1 + random.nextInt(maxLength);
+
+            {
+                const auto m = makeBlockCoefficients(section);
+                std::vector<float> input(static_cast<size_t>(length)), a, b;
+                for(auto& x : input)
+                    x = random.nextFloat() * 2.f - 1.f;
+                a = b = input;
+
+                BiquadState stateA, stateB;
+                generic.processBlockRecursive(m, stateA, a.data(), length);
+                kernels.processBlockRecursive(m, stateB, b.data(), length);
+
+                double s1 = 0, s2 = 0, inputEnergy = 0, genericErrorEnergy = 0, errorEnergy = 0;
+                for(size_t i = 0; i < input.size(); ++i)
+                {
+                    const double x = input[i];
+                    const auto y = section.b0 * x + s1;
+                    s1 = section.b1 * x - section.a1 * y + s2;
+                    s2 = section.b2 * x - section.a2 * y;
+
+                    inputEnergy += x * x;
+                    genericErrorEnergy += juce::square(a[i] - y);
+                    errorEnergy += juce::square(b[i] - y);
+                }
+
+                if(inputEnergy > 0)
+                {
+                    blockErrorEnergy += errorEnergy / inputEnergy;
+                    genericBlockErrorEnergy += genericErrorEnergy / inputEnergy;
+                }
+            }
+
+            {
+                const auto polynomials = getBandMagnitudeFunction(getKernelType(type, design))(section);
+                std::vector<double> phi(static_cast<size_t>(length)), a(phi.size(), 1.0), b(phi.size(), 1.0);
+                for(auto& p : phi)
+                    p = random.nextDouble();
+
+                generic.multiplyMagnitudes(polynomials, phi.data(), a.data(), length);
+                kernels.multiplyMagnitudes(polynomials, phi.data(), b.data(), length);
+
+                auto toDecibels = [](double magnitudeSquared) { return 10.0 * std::log10(juce::jmax(magnitudeSquared, 1.0e-12)); };
+                for(size_t k = 0; k < phi.size(); ++k)
+                    check.magnitudeError = juce::jmax(check.magnitudeError, std::abs(toDecibels(a[k]) - toDecibels(b[k])));
+            }
+
+            {
+                std::vector<float> source(static_cast<size_t>(length)), window(source.size()), a(source.size()), b(source.size());
+                for(size_t i = 0; i < source.size(); ++i)
+                {
+                    source[i] = random.nextFloat() * 2.f - 1.f;
+                    window[i] = random.nextFloat();
+                }
+
+                generic.applyWindow(a.data(), source.data(), window.data(), length);
+                kernels.applyWindow(b.data(), source.data(), window.data(), length);
+
+                std::vector<double> sumsA(source.size(), 1.0), sumsB(source.size(), 1.0);
+                generic.addPowers(sumsA.data(), a.data(), length);
+                kernels.addPowers(sumsB.data(), b.data(), length);
+
+                for(size_t i = 0; i < source.size(); ++i)
+                    check.spectrumError = juce::jmax(check.spectrumError, std::abs(sumsA[i] - sumsB[i]) / sumsA[i]);
+            }
+        }
+
+        check.blockError = std::sqrt(blockErrorEnergy / numTrials);
+        check.genericBlockError = std::sqrt(genericBlockErrorEnergy / numTrials);
+
+        check.passed = check.blockError <= blockErrorRatio * check.genericBlockError
+                    && check.magnitudeError <= magnitudeToleranceInDecibels && check.spectrumError <= spectrumTolerance;
+        checks.push_back(check);
+    }
+
+    return checks;
+}
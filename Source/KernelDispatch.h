@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    Run-time instruction set dispatch for the vectorisable kernels.
+
+    The plug-in is built once for the baseline instruction set of its target
+    (SSE2 on x64), so one binary runs on every machine. The kernels whose
+    work is independent multiply-adds, rather than a serial recurrence, are
+    also compiled for AVX2 + FMA and for AVX-512:
+
+      - the block recursive biquad, which long blocks and offline renders run,
+      - the magnitude response over many points, for the response curve and
+        the match EQ fit,
+      - the match EQ analyser's window and power spectrum accumulation
+        around the FFT.
+
+    The widest variant the CPU supports is picked once, from CPUID, the first
+    time getKernels() is called (the processor's constructor does that, so
+    never the audio thread), and every caller goes through its table.
+
+    The per-sample cascades are serial in every state, so wider registers do
+    nothing for them and they only exist in the baseline build. Each variant
+    is compiled with per-function target attributes, which only GCC and Clang
+    offer; other compilers build the generic table alone.
+
+    The variants fuse multiplies and adds, so they round differently from the
+    generic kernels: checkKernelVariants() runs each one the CPU supports on
+    the same random inputs as the generic table and reports how far apart
+    they are (StressBench --check-kernels).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "FilterKernels.h"
+
+#ifndef FIVEBANDEQ_KERNEL_VARIANTS
+ #if JUCE_INTEL && (JUCE_GCC || JUCE_CLANG)
+  #define FIVEBANDEQ_KERNEL_VARIANTS 1
+ #else
+  #define FIVEBANDEQ_KERNEL_VARIANTS 0
+ #endif
+#endif
+
+enum KernelVariant
+{
+    Kernels_Generic,
+    Kernels_AVX2,       // AVX2 and FMA
+    Kernels_AVX512,     // AVX-512F
+    NumKernelVariants
+};
+
+const juce::StringArray& getKernelVariantNames();
+
+struct KernelTable
+{
+    // As BlockRecursiveKernel::process().
+    void (*processBlockRecursive)(const BlockCoefficients& m, BiquadState& state, float* data, int numSamples) noexcept;
+
+    // Multiplies each magnitudesSquared[k] by the section's |H|^2 at phi[k].
+    void (*multiplyMagnitudes)(const MagnitudePolynomials& section, const double* phi,
+                               double* magnitudesSquared, int numPoints) noexcept;
+
+    // dest[i] = source[i] * window[i].
+    void (*applyWindow)(float* dest, const float* source, const float* window, int numSamples) noexcept;
+
+    // sums[i] += magnitudes[i]^2, the squares taken in double.
+    void (*addPowers)(double* sums, const float* magnitudes, int numBins) noexcept;
+};
+
+// Whether the variant was compiled in and this CPU can run it.
+bool isKernelVariantAvailable(KernelVariant variant);
+KernelVariant getBestKernelVariant();
+
+// The table in use. Cheap enough to call once per block.
+const KernelTable& getKernels() noexcept;
+const KernelTable& getKernels(KernelVariant variant);
+KernelVariant getActiveKernelVariant() noexcept;
+
+// Replaces the choice getKernels() made, for the tools that compare variants. variant
+// must be available, and nothing may be processing while it changes.
+void setActiveKernelVariant(KernelVariant variant);
+
+struct KernelCheck
+{
+    KernelVariant variant;
+
+    // The block kernels' RMS errors against the same recursion in double, relative to the
+    // input's RMS level, over all the trials: the variant's and the generic kernel's.
+    double blockError = 0, genericBlockError = 0;
+
+    // The largest differences from the generic table: in dB for the magnitudes (down to
+    // -120 dB), relative for the power sums.
+    double magnitudeError = 0, spectrumError = 0;
+
+    bool passed = false;
+};
+
+// Runs every available variant other than the generic one on random sections and signals,
+// and compares it with the generic table on the same inputs.
+std::vector<KernelCheck> checkKernelVariants(juce::int64 seed);
@@ -0,0 +1,224 @@
+/*
+  ==============================================================================
+
+    ITU-R BS.1770 loudness metering.
+
+  ==============================================================================
+*/
+
+#include "LoudnessMeter.h"
+
+namespace
+{
+    // Loudness of a K-weighted mean square, BS.1770 eq. 2.
+    double toLoudness(double energy) noexcept
+    {
+        return energy > 0.0 ? -0.691 + 10.0 * std::log10(energy) : LoudnessMeter::silence;
+    }
+}
+
+size_t LoudnessMeter::getArenaSize(int numChannels) noexcept
+{
+    const auto count = static_cast<size_t>(juce::jmax(1, numChannels));
+    return InstanceArena::getSize<ChannelState>(count) + InstanceArena::getSize<double>(count);
+}
+
+void LoudnessMeter::prepare(double sampleRate, const juce::AudioChannelSet& channels, InstanceArena& arena)
+{
+    // The BS.1770 filters are specified at 48 kHz; these are the analog prototypes they
+    // come from, as fitted by libebur128, so any other rate gets the same response.
+    {
+        const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+        const auto k = std::tan(juce::MathConstants<double>::pi * f0 / sampleRate);
+        const auto vh = std::pow(10.0, gain / 20.0);
+        const auto vb = std::pow(vh, 0.4996667741545416);
+        const auto a0 = 1.0 + k / q + k * k;
+
+        preFilter = { (vh + vb * k / q + k * k) / a0,
+                      2.0 * (k * k - vh) / a0,
+                      (vh - vb * k / q + k * k) / a0,
+                      2.0 * (k * k - 1.0) / a0,
+                      (1.0 - k / q + k * k) / a0 };
+    }
+    {
+        const double f0 = 38.13547087602444, q = 0.5003270373238773;
+        const auto k = std::tan(juce::MathConstants<double>::pi * f0 / sampleRate);
+        const auto a0 = 1.0 + k / q + k * k;
+
+        highPass = { 1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+    }
+
+    const auto numChannels = juce::jmax(1, channels.size());
+    states = arena.allocate<ChannelState>(static_cast<size_t>(numChannels));
+    weights = arena.allocate<double>(static_cast<size_t>(numChannels));
+    std::fill(weights.begin(), weights.end(), 1.0);
+
+    for(int ch = 0; ch < channels.size(); ++ch)
+    {
+        switch(channels.getTypeOfChannel(ch))
+        {
+            case juce::AudioChannelSet::LFE:
+            case juce::AudioChannelSet::LFE2:
+                weights[static_cast<size_t>(ch)] = 0.0;
+                break;
+            case juce::AudioChannelSet::leftSurround:
+            case juce::AudioChannelSet::rightSurround:
+            case juce::AudioChannelSet::leftSurroundSide:
+            case juce::AudioChannelSet::rightSurroundSide:
+            case juce::AudioChannelSet::leftSurroundRear:
+            case juce::AudioChannelSet::rightSurroundRear:
+                weights[static_cast<size_t>(ch)] = 1.41;
+                break;
+            default:
+                break;
+        }
+    }
+
+    stepLength = juce::jmax(1, juce::roundToInt(sampleRate * 0.1));
+    stepPosition = 0;
+    stepSum = 0;
+    steps = {};
+    stepIndex = numSteps = 0;
+
+    clearHistogram();
+    resetRequested.store(false, std::memory_order_relaxed);
+
+    momentary = silence;
+    shortTerm = silence;
+    integrated = silence;
+}
+
+bool LoudnessMeter::process(const float* const* channels, int numChannels, int numSamples) noexcept
+{
+    if(resetRequested.exchange(false, std::memory_order_relaxed))
+    {
+        clearHistogram();
+        integrated.store(silence, std::memory_order_relaxed);
+    }
+
+    numChannels = juce::jmin(numChannels, static_cast<int>(states.size()));
+    bool completed = false;
+
+    for(int start = 0; start < numSamples; )
+    {
+        const auto length = juce::jmin(numSamples - start, stepLength - stepPosition);
+
+        for(int ch = 0; ch < numChannels; ++ch)
+        {
+            const auto weight = weights[static_cast<size_t>(ch)];
+            if(weight == 0.0)
+                continue;
+
+            auto state = states[static_cast<size_t>(ch)];
+            const auto* data = channels[ch] + start;
+            double sum = 0;
+
+            for(int i = 0; i < length; ++i)
+            {
+                const double x = data[i];
+
+                const auto y = preFilter.b0 * x + state.s1;
+                state.s1 = preFilter.b1 * x - preFilter.a1 * y + state.s2;
+                state.s2 = preFilter.b2 * x - preFilter.a2 * y;
+
+                const auto z = highPass.b0 * y + state.t1;
+                state.t1 = highPass.b1 * y - highPass.a1 * z + state.t2;
+                state.t2 = highPass.b2 * y - highPass.a2 * z;
+
+                sum += z * z;
+            }
+
+            states[static_cast<size_t>(ch)] = state;
+            stepSum += weight * sum;
+        }
+
+        start += length;
+        stepPosition += length;
+
+        if(stepPosition == stepLength)
+        {
+            completeStep();
+            completed = true;
+        }
+    }
+
+    return completed;
+}
+
+void LoudnessMeter::completeStep() noexcept
+{
+    steps[static_cast<size_t>(stepIndex)] = stepSum / stepLength;
+    stepIndex = (stepIndex + 1) % shortTermSteps;
+    numSteps = juce::jmin(numSteps + 1, shortTermSteps);
+    stepSum = 0;
+    stepPosition = 0;
+
+    // Sums of the most recent steps, newest first.
+    auto sumRecent = [this](int count)
+    {
+        double sum = 0;
+        for(int i = 1; i <= count; ++i)
+            sum += steps[static_cast<size_t>((stepIndex - i + shortTermSteps) % shortTermSteps)];
+        return sum;
+    };
+
+    // Until a window has filled there is no reading for it, as BS.1770 leaves it undefined.
+    if(numSteps >= momentarySteps)
+    {
+        const auto blockEnergy = sumRecent(momentarySteps) / momentarySteps;
+        momentary.store(static_cast<float>(toLoudness(blockEnergy)), std::memory_order_relaxed);
+
+        addBlock(blockEnergy);
+        integrated.store(getIntegrated(), std::memory_order_relaxed);
+    }
+
+    if(numSteps == shortTermSteps)
+        shortTerm.store(static_cast<float>(toLoudness(sumRecent(shortTermSteps) / shortTermSteps)), std::memory_order_relaxed);
+}
+
+void LoudnessMeter::addBlock(double energy) noexcept
+{
+    const auto loudness = toLoudness(energy);
+    if(loudness <= absoluteGate)
+        return;
+
+    const auto bin = juce::jlimit(0, numBins - 1, static_cast<int>((loudness - absoluteGate) * binsPerLU));
+    binEnergy[static_cast<size_t>(bin)] += energy;
+    ++binCount[static_cast<size_t>(bin)];
+    gatedEnergy += energy;
+    ++gatedCount;
+}
+
+float LoudnessMeter::getIntegrated() const noexcept
+{
+    if(gatedCount == 0)
+        return silence;
+
+    const auto gate = toLoudness(gatedEnergy / static_cast<double>(gatedCount)) + relativeGate;
+    const auto firstBin = juce::jlimit(0, numBins, static_cast<int>(std::ceil((gate - absoluteGate) * binsPerLU)));
+
+    double energy = 0;
+    juce::uint64 count = 0;
+    for(int bin = firstBin; bin < numBins; ++bin)
+    {
+        energy += binEnergy[static_cast<size_t>(bin)];
+        count += binCount[static_cast<size_t>(bin)];
+    }
+
+    return count > 0 ? static_cast<float>(toLoudness(energy / static_cast<double>(count))) : silence;
+}
+
+void LoudnessMeter::clearHistogram() noexcept
+{
+    binEnergy = {};
+    binCount = {};
+    gatedEnergy = 0;
+    gatedCount = 0;
+}
+
+LoudnessMeter::Readings LoudnessMeter::getReadings() const noexcept
+{
+    return { momentary.load(std::memory_order_relaxed),
+             shortTerm.load(std::memory_order_relaxed),
+             integrated.load(std::memory_order_relaxed) };
+}
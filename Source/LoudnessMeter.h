@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    ITU-R BS.1770 loudness metering.
+
+    Every channel is K-weighted (the high shelf "pre-filter" followed by the
+    RLB high pass, designed for the actual sample rate) and its mean square
+    summed with the BS.1770 channel weights into 100 ms steps. Momentary
+    loudness averages the last 4 steps (400 ms), short-term the last 30 (3 s).
+
+    Integrated loudness gates the 400 ms blocks, one per step, as BS.1770-4
+    describes: blocks below -70 LUFS are dropped, then blocks more than 10 LU
+    below the loudness of the rest. Blocks go into a histogram of 0.1 LU bins
+    holding their count and summed energy, so adding one is O(1) however long
+    the meter has run, and gating walks the fixed number of bins once a step.
+    Only the relative gate is rounded to a bin edge.
+
+    process() runs on the audio thread and never allocates or locks. The
+    readings are atomics, so any thread can read them at any time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "InstanceArena.h"
+
+class LoudnessMeter
+{
+public:
+    // What the readings show before anything was measured, or for silence.
+    static constexpr float silence = -100.f;
+
+    struct Readings
+    {
+        float momentary = silence, shortTerm = silence, integrated = silence;
+    };
+
+    // The arena space prepare() takes for numChannels channels.
+    static size_t getArenaSize(int numChannels) noexcept;
+
+    // Not real-time safe; the channel states come from arena. The channel set gives the
+    // BS.1770 weight of each channel: the LFE is left out and the surround channels count
+    // 1.41 times.
+    void prepare(double sampleRate, const juce::AudioChannelSet& channels, InstanceArena& arena);
+
+    // Audio thread. Returns true when a 100 ms step completed in this call, so the short
+    // term loudness has moved.
+    bool process(const float* const* channels, int numChannels, int numSamples) noexcept;
+
+    Readings getReadings() const noexcept;
+
+    // Any thread. Restarts the integrated loudness at the next process() call.
+    void resetIntegrated() noexcept { resetRequested.store(true, std::memory_order_relaxed); }
+
+private:
+    struct Biquad
+    {
+        double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+    };
+
+    // Both K-weighting stages of one channel, transposed direct form II.
+    struct ChannelState
+    {
+        double s1 = 0, s2 = 0, t1 = 0, t2 = 0;
+    };
+
+    static constexpr int momentarySteps = 4;
+    static constexpr int shortTermSteps = 30;
+
+    static constexpr float absoluteGate = -70.f;
+    static constexpr float relativeGate = -10.f;
+    static constexpr float histogramTop = 5.f;
+    static constexpr float binsPerLU = 10.f;
+    static constexpr int numBins = static_cast<int>((histogramTop - absoluteGate) * binsPerLU);
+
+    void completeStep() noexcept;
+    void addBlock(double energy) noexcept;
+    float getIntegrated() const noexcept;
+    void clearHistogram() noexcept;
+
+    Biquad preFilter, highPass;
+    ArenaArray<ChannelState> states;
+    ArenaArray<double> weights;
+
+    int stepLength = 0, stepPosition = 0;
+    double stepSum = 0;
+
+    // Mean square of the last shortTermSteps steps, oldest first once it has wrapped.
+    std::array<double, shortTermSteps> steps {};
+    int stepIndex = 0, numSteps = 0;
+
+    std::array<double, numBins> binEnergy {};
+    std::array<juce::uint32, numBins> binCount {};
+    double gatedEnergy = 0;
+    juce::uint64 gatedCount = 0;
+
+    std::atomic<float> momentary { silence }, shortTerm { silence }, integrated { silence };
+    std::atomic<bool> resetRequested { false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LoudnessMeter)
+};
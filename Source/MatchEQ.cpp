@@ -0,0 +1,429 @@
+/*
+  ==============================================================================
+
+    Match EQ: long-term spectrum capture and curve fitting.
+
+  ==============================================================================
+*/
+
+#include "MatchEQ.h"
+#include "KernelDispatch.h"
+
+namespace
+{
+    constexpr int numFitPoints = 256;
+    constexpr double fitToleranceInDecibels = 0.5;
+    constexpr int minFramesForFit = 8;
+
+    // Log-spaced evaluation points, with the phi values the response kernels take precomputed.
+    struct FitGrid
+    {
+        FitGrid(double sampleRate, DesignMethod designMethod) : design(designMethod)
+        {
+            auto maxFreq = juce::jmin(20000.0, sampleRate * 0.45);
+            for(int k = 0; k < numFitPoints; ++k)
+            {
+                freqs[k] = juce::mapToLog10(double(k) / double(numFitPoints - 1), 20.0, maxFreq);
+                phi[k] = getPhi(freqs[k], sampleRate);
+            }
+        }
+
+        std::array<double, numFitPoints> freqs, phi;
+        DesignMethod design;
+    };
+
+    using Curve = std::array<double, numFitPoints>;
+
+    void getBandCurve(const BandSettings& band, double sampleRate, const FitGrid& grid, Curve& curve)
+    {
+        auto coefficients = makeBandFilter(band, sampleRate, grid.design);
+        auto polynomials = getBandMagnitudeFunction(getKernelType(band.type, grid.design))(coefficients);
+
+        curve.fill(1.0);
+        getKernels().multiplyMagnitudes(polynomials, grid.phi.data(), curve.data(), numFitPoints);
+        for(auto& point : curve)
+            point = 10.0 * std::log10(point);
+    }
+
+    void addCutCurve(const CutCoefficients& sections, int numSections, const FitGrid& grid, Curve& curve)
+    {
+        Curve magnitudesSquared;
+        magnitudesSquared.fill(1.0);
+        for(int i = 0; i < numSections; ++i)
+            getKernels().multiplyMagnitudes(getBiquadMagnitudePolynomials(sections[i]), grid.phi.data(),
+                                            magnitudesSquared.data(), numFitPoints);
+
+        for(int k = 0; k < numFitPoints; ++k)
+            curve[k] += 10.0 * std::log10(magnitudesSquared[k]);
+    }
+
+    double getError(const Curve& target, const Curve& curve)
+    {
+        double error = 0;
+        for(int k = 0; k < numFitPoints; ++k)
+            error += juce::square(target[k] - curve[k]);
+        return error;
+    }
+
+    // Coordinate descent on log-frequency, gain and log-Q, halving the steps whenever
+    // no single move improves the fit.
+    void refineBand(BandSettings& band, const Curve& target, double sampleRate, const FitGrid& grid)
+    {
+        auto maxFreq = grid.freqs.back();
+        auto clampBand = [maxFreq](BandSettings b)
+        {
+            b.freq = juce::jlimit(20.f, static_cast<float>(maxFreq), b.freq);
+            b.gainInDecibels = juce::jlimit(-24.f, 24.f, b.gainInDecibels);
+            b.quality = juce::jlimit(0.1f, 10.f, b.quality);
+            return b;
+        };
+
+        Curve curve;
+        getBandCurve(band, sampleRate, grid, curve);
+        auto bestError = getError(target, curve);
+
+        float freqStep = 1.f / 3.f, gainStep = 2.f, qualityStep = 0.5f;
+
+        for(int iteration = 0; iteration < 64 && freqStep > 1.f / 48.f; ++iteration)
+        {
+            bool improved = false;
+
+            for(int move = 0; move < 6; ++move)
+            {
+                auto candidate = band;
+                auto direction = (move & 1) ? -1.f : 1.f;
+                switch(move / 2)
+                {
+                    case 0: candidate.freq *= std::exp2(direction * freqStep); break;
+                    case 1: candidate.gainInDecibels += direction * gainStep; break;
+                    default: candidate.quality *= std::exp2(direction * qualityStep); break;
+                }
+                candidate = clampBand(candidate);
+
+                getBandCurve(candidate, sampleRate, grid, curve);
+                auto error = getError(target, curve);
+                if(error < bestError)
+                {
+                    bestError = error;
+                    band = candidate;
+                    improved = true;
+                }
+            }
+
+            if(! improved)
+            {
+                freqStep *= 0.5f;
+                gainStep *= 0.5f;
+                qualityStep *= 0.5f;
+            }
+        }
+    }
+
+    Slope getNearestSlope(double decibelsPerOctave)
+    {
+        auto index = juce::roundToInt(std::abs(decibelsPerOctave) / 12.0) - 1;
+        return static_cast<Slope>(juce::jlimit(0, static_cast<int>(Slope_96), index));
+    }
+}
+
+//==============================================================================
+void MatchEQ::Worker::run()
+{
+    while(! threadShouldExit())
+    {
+        matchEQ.drainFifo();
+
+        // Polls while a capture runs. Once it has stopped and the FIFO is drained there is
+        // nothing left to do until startCapture() or stopThread() wakes it.
+        const bool busy = matchEQ.capturing.load() >= 0 || matchEQ.fifo.getNumReady() > 0;
+        wait(busy ? 20 : -1);
+    }
+}
+
+MatchEQ::MatchEQ()
+{
+}
+
+MatchEQ::~MatchEQ()
+{
+    worker.stopThread(2000);
+}
+
+void MatchEQ::prepare(double sampleRate)
+{
+    // A capture taken at another rate doesn't line up with the new bins.
+    if(sampleRate != currentSampleRate.load())
+    {
+        clear(Reference);
+        clear(Input);
+    }
+    currentSampleRate = sampleRate;
+}
+
+void MatchEQ::allocate()
+{
+    if(allocated)
+        return;
+
+    fifoBuffer.resize(fifoSize);
+    fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+    window.resize(fftSize);
+    frame.resize(fftSize);
+    fftData.resize(2 * fftSize);
+    juce::dsp::WindowingFunction<float>::fillWindowingTables(window.data(), fftSize, juce::dsp::WindowingFunction<float>::hann, false);
+
+    {
+        const juce::ScopedLock sl(spectrumLock);
+        for(auto& sums : powerSums)
+            sums.resize(numBins);
+    }
+
+    allocated = true;
+}
+
+void MatchEQ::pushSamples(const juce::AudioBuffer<float>& buffer) noexcept
+{
+    // Acquire pairs with startCapture, so the buffers allocated there are visible here.
+    if(capturing.load(std::memory_order_acquire) < 0)
+        return;
+
+    auto numChannels = buffer.getNumChannels();
+    if(numChannels == 0)
+        return;
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(buffer.getNumSamples(), start1, size1, start2, size2);
+
+    // Mix down to mono on the way in; anything that doesn't fit is dropped rather than waited for.
+    auto gain = 1.f / numChannels;
+    auto mixDown = [&](int sourceStart, float* dest, int numSamples)
+    {
+        if(numSamples <= 0)
+            return;
+        juce::FloatVectorOperations::copyWithMultiply(dest, buffer.getReadPointer(0, sourceStart), gain, numSamples);
+        for(int ch = 1; ch < numChannels; ++ch)
+            juce::FloatVectorOperations::addWithMultiply(dest, buffer.getReadPointer(ch, sourceStart), gain, numSamples);
+    };
+
+    mixDown(0, fifoBuffer.data() + start1, size1);
+    mixDown(size1, fifoBuffer.data() + start2, size2);
+    fifo.finishedWrite(size1 + size2);
+}
+
+void MatchEQ::startCapture(Target target)
+{
+    allocate();
+    capturing = target;
+    if(worker.isThreadRunning())
+        worker.notify();
+    else
+        worker.startThread();
+}
+
+void MatchEQ::stopCapture()
+{
+    capturing = -1;
+}
+
+void MatchEQ::clear(Target target)
+{
+    const juce::ScopedLock sl(spectrumLock);
+    std::fill(powerSums[target].begin(), powerSums[target].end(), 0.0);
+    numFrames[target] = 0;
+}
+
+int MatchEQ::getNumFrames(Target target) const
+{
+    const juce::ScopedLock sl(spectrumLock);
+    return numFrames[target];
+}
+
+bool MatchEQ::canFit() const
+{
+    return currentSampleRate.load() > 0
+        && getNumFrames(Reference) >= minFramesForFit
+        && getNumFrames(Input) >= minFramesForFit;
+}
+
+size_t MatchEQ::getAllocatedBytes() const
+{
+    if(! allocated)
+        return 0;
+
+    // These only change size in allocate(), on this thread.
+    auto numBytes = (fifoBuffer.capacity() + window.capacity() + frame.capacity() + fftData.capacity()) * sizeof(float)
+                  + sizeof(juce::dsp::FFT);
+    for(const auto& sums : powerSums)
+        numBytes += sums.capacity() * sizeof(double);
+    return numBytes;
+}
+
+void MatchEQ::drainFifo()
+{
+    while(fifo.getNumReady() > 0)
+    {
+        auto target = capturing.load();
+        if(target != lastTarget)
+        {
+            framePosition = 0;
+            lastTarget = target;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(juce::jmin(fifo.getNumReady(), fftSize - framePosition), start1, size1, start2, size2);
+
+        std::copy_n(fifoBuffer.data() + start1, size1, frame.data() + framePosition);
+        std::copy_n(fifoBuffer.data() + start2, size2, frame.data() + framePosition + size1);
+        framePosition += size1 + size2;
+        fifo.finishedRead(size1 + size2);
+
+        if(framePosition == fftSize)
+        {
+            if(target >= 0)
+                addFrame(static_cast<Target>(target));
+
+            std::copy(frame.begin() + hopSize, frame.end(), frame.begin());
+            framePosition = fftSize - hopSize;
+        }
+    }
+}
+
+void MatchEQ::addFrame(Target target)
+{
+    const auto& kernels = getKernels();
+    kernels.applyWindow(fftData.data(), frame.data(), window.data(), fftSize);
+    std::fill(fftData.begin() + fftSize, fftData.end(), 0.f);
+    fft->performFrequencyOnlyForwardTransform(fftData.data());
+
+    const juce::ScopedLock sl(spectrumLock);
+    kernels.addPowers(powerSums[target].data(), fftData.data(), numBins);
+    ++numFrames[target];
+}
+
+//==============================================================================
+ChainSettings MatchEQ::fit(const ChainSettings& currentSettings) const
+{
+    if(! canFit())
+        return currentSettings;
+
+    auto sampleRate = currentSampleRate.load();
+
+    std::array<std::vector<double>, NumTargets> spectra;
+    std::array<int, NumTargets> frames;
+    {
+        const juce::ScopedLock sl(spectrumLock);
+        spectra = powerSums;
+        frames = numFrames;
+    }
+
+    FitGrid grid(sampleRate, currentSettings.design);
+
+    // Difference curve, averaged over 1/3 octave around each point.
+    Curve target;
+    auto binWidth = sampleRate / fftSize;
+    for(int k = 0; k < numFitPoints; ++k)
+    {
+        auto lowBin = juce::jlimit(1, numBins - 1, static_cast<int>(grid.freqs[k] * std::exp2(-1.0 / 6.0) / binWidth));
+        auto highBin = juce::jlimit(lowBin, numBins - 1, static_cast<int>(grid.freqs[k] * std::exp2(1.0 / 6.0) / binWidth));
+
+        double reference = 0, input = 0;
+        for(int bin = lowBin; bin <= highBin; ++bin)
+        {
+            reference += spectra[Reference][bin];
+            input += spectra[Input][bin];
+        }
+
+        reference /= frames[Reference];
+        input /= frames[Input];
+        target[k] = 10.0 * std::log10((reference + 1e-12) / (input + 1e-12));
+    }
+
+    // The overall level difference is not something the EQ should try to match.
+    auto offset = std::accumulate(target.begin(), target.end(), 0.0) / numFitPoints;
+    for(auto& t : target)
+        t = juce::jlimit(-24.0, 24.0, t - offset);
+
+    auto settings = currentSettings;
+
+    // Cut filters go where the reference rolls off by more than the bands could follow.
+    settings.lowCutFreq = 20.f;
+    settings.lowCutSlope = Slope_12;
+    settings.highCutFreq = 20000.f;
+    settings.highCutSlope = Slope_12;
+
+    int lowEdge = 0;
+    while(lowEdge < numFitPoints / 2 && target[lowEdge] < -3.0)
+        ++lowEdge;
+    if(lowEdge > 0 && target[0] < -6.0)
+    {
+        settings.lowCutFreq = static_cast<float>(grid.freqs[lowEdge]);
+        auto octaves = std::log2(grid.freqs[lowEdge] / grid.freqs[0]);
+        settings.lowCutSlope = getNearestSlope((target[lowEdge] - target[0]) / juce::jmax(octaves, 0.5));
+    }
+
+    int highEdge = numFitPoints - 1;
+    while(highEdge > numFitPoints / 2 && target[highEdge] < -3.0)
+        --highEdge;
+    if(highEdge < numFitPoints - 1 && target[numFitPoints - 1] < -6.0)
+    {
+        settings.highCutFreq = static_cast<float>(grid.freqs[highEdge]);
+        auto octaves = std::log2(grid.freqs[numFitPoints - 1] / grid.freqs[highEdge]);
+        settings.highCutSlope = getNearestSlope((target[highEdge] - target[numFitPoints - 1]) / juce::jmax(octaves, 0.5));
+    }
+
+    Curve residual = target;
+    {
+        Curve cutCurve {};
+        CutCoefficients sections;
+        addCutCurve(sections, makeLowCutFilter(settings, sampleRate, sections), grid, cutCurve);
+        addCutCurve(sections, makeHighCutFilter(settings, sampleRate, sections), grid, cutCurve);
+        for(int k = 0; k < numFitPoints; ++k)
+            residual[k] -= cutCurve[k];
+    }
+
+    // Greedily place a peak on the largest remaining error, then refine all of them together.
+    std::array<Curve, maxBands> bandCurves;
+    int numFitted = 0;
+
+    for(; numFitted < maxBands; ++numFitted)
+    {
+        auto worst = std::max_element(residual.begin(), residual.end(),
+                                      [](double a, double b) { return std::abs(a) < std::abs(b); });
+        if(std::abs(*worst) < fitToleranceInDecibels)
+            break;
+
+        BandSettings band;
+        band.enabled = true;
+        band.type = Peak;
+        band.freq = static_cast<float>(grid.freqs[std::distance(residual.begin(), worst)]);
+        band.gainInDecibels = static_cast<float>(*worst);
+        band.quality = 1.f;
+
+        refineBand(band, residual, sampleRate, grid);
+        getBandCurve(band, sampleRate, grid, bandCurves[numFitted]);
+        for(int k = 0; k < numFitPoints; ++k)
+            residual[k] -= bandCurves[numFitted][k];
+
+        settings.bands[numFitted] = band;
+    }
+
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        for(int i = 0; i < numFitted; ++i)
+        {
+            for(int k = 0; k < numFitPoints; ++k)
+                residual[k] += bandCurves[i][k];
+
+            refineBand(settings.bands[i], residual, sampleRate, grid);
+            getBandCurve(settings.bands[i], sampleRate, grid, bandCurves[i]);
+
+            for(int k = 0; k < numFitPoints; ++k)
+                residual[k] -= bandCurves[i][k];
+        }
+    }
+
+    for(int i = numFitted; i < maxBands; ++i)
+        settings.bands[i].enabled = false;
+
+    return settings;
+}
@@ -0,0 +1,97 @@
+/*
+  ==============================================================================
+
+    Match EQ: long-term spectrum capture and curve fitting.
+
+    processBlock() hands the input to pushSamples(), which only mixes it down
+    into a lock-free FIFO while a capture is running. A worker thread drains
+    the FIFO and Welch-averages Hann-windowed, 50% overlapped FFT frames into
+    the spectrum of whichever target is being captured.
+
+    fit() turns the difference between the reference and input spectra into
+    ChainSettings: the cut filters are placed where the reference rolls off and
+    peak bands are added greedily, each refined by coordinate descent on the
+    analytic band response.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+class MatchEQ
+{
+public:
+    enum Target
+    {
+        Reference,
+        Input,
+        NumTargets
+    };
+
+    MatchEQ();
+    ~MatchEQ();
+
+    void prepare(double sampleRate);
+
+    // Audio thread. Does nothing unless a capture is running, never blocks.
+    void pushSamples(const juce::AudioBuffer<float>& buffer) noexcept;
+
+    // Message thread.
+    void startCapture(Target target);
+    void stopCapture();
+    void clear(Target target);
+    int getNumFrames(Target target) const;
+    bool canFit() const;
+
+    // Message thread. The analysis buffers, or 0 before the first capture. The FFT engine's
+    // own tables aren't included.
+    size_t getAllocatedBytes() const;
+
+    // Returns currentSettings with the cut filters and bands replaced by the best fit of the
+    // reference/input difference curve, or currentSettings unchanged if there is nothing to fit.
+    ChainSettings fit(const ChainSettings& currentSettings) const;
+
+private:
+    static constexpr int fftOrder = 12;
+    static constexpr int fftSize = 1 << fftOrder;
+    static constexpr int hopSize = fftSize / 2;
+    static constexpr int numBins = fftSize / 2 + 1;
+    static constexpr int fifoSize = 1 << 16;
+
+    struct Worker : juce::Thread
+    {
+        Worker(MatchEQ& owner) : juce::Thread("Match EQ"), matchEQ(owner) {}
+        void run() override;
+        MatchEQ& matchEQ;
+    };
+
+    // The analysis buffers are only allocated when the first capture starts, as most instances
+    // never capture anything.
+    void allocate();
+    bool allocated = false;
+
+    void drainFifo();
+    void addFrame(Target target);
+
+    juce::AbstractFifo fifo { fifoSize };
+    std::vector<float> fifoBuffer;
+    std::atomic<int> capturing { -1 };
+    std::atomic<double> currentSampleRate { 0 };
+
+    // Worker thread only.
+    std::unique_ptr<juce::dsp::FFT> fft;
+    std::vector<float> window, frame, fftData;
+    int framePosition = 0;
+    int lastTarget = -1;
+
+    juce::CriticalSection spectrumLock;
+    std::array<std::vector<double>, NumTargets> powerSums;
+    std::array<int, NumTargets> numFrames {};
+
+    Worker worker { *this };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MatchEQ)
+};
@@ -0,0 +1,222 @@
+/*
+  ==============================================================================
+
+    Chunk-parallel offline rendering.
+
+  ==============================================================================
+*/
+
+#include "OfflineRenderer.h"
+#include "KernelDispatch.h"
+
+namespace
+{
+    // Zero-input states this small no longer move a float output.
+    constexpr double negligibleState = 1.0e-9;
+    constexpr int numQuietSamples = 64;
+
+    std::vector<double> multiply(const std::vector<double>& a, const std::vector<double>& b, int size)
+    {
+        std::vector<double> result(static_cast<size_t>(size * size), 0.0);
+        for(int r = 0; r < size; ++r)
+            for(int k = 0; k < size; ++k)
+            {
+                auto x = a[static_cast<size_t>(r * size + k)];
+                if(x == 0.0)
+                    continue;
+                for(int c = 0; c < size; ++c)
+                    result[static_cast<size_t>(r * size + c)] += x * b[static_cast<size_t>(k * size + c)];
+            }
+        return result;
+    }
+
+    // One sample of the cascade with the given input, in double. Returns the cascade's output.
+    double tickCascade(const std::array<BiquadCoefficients, maxChainSections>& sections, int numSections,
+                       double* state, double x) noexcept
+    {
+        for(int i = 0; i < numSections; ++i)
+        {
+            const auto& c = sections[static_cast<size_t>(i)];
+            auto* s = state + 2 * i;
+            auto y = c.b0 * x + s[0];
+            s[0] = c.b1 * x - c.a1 * y + s[1];
+            s[1] = c.b2 * x - c.a2 * y;
+            x = y;
+        }
+        return x;
+    }
+}
+
+OfflineRenderer::OfflineRenderer(const ChainCoefficients& coefficients, int numChannels, int length)
+    : chunkLength(juce::jmax(BlockCoefficients::blockLength, length))
+{
+    const bool stereo = numChannels == 2 && coefficients.stereoMode != Stereo_Linked;
+    midSide = numChannels == 2 && coefficients.stereoMode == Stereo_MidSide;
+
+    for(int l = 0; l < StereoCascade::numLanes; ++l)
+    {
+        auto& lane = lanes[static_cast<size_t>(l)];
+        lane.numSections = coefficients.getSections(l, lane.sections);
+
+        for(int i = 0; i < lane.numSections; ++i)
+            lane.blockSections.push_back(makeBlockCoefficients(lane.sections[static_cast<size_t>(i)]));
+
+        // Column j is where one zero-input sample takes the unit state j.
+        const int size = 2 * lane.numSections;
+        lane.step.assign(static_cast<size_t>(size * size), 0.0);
+        for(int j = 0; j < size; ++j)
+        {
+            std::vector<double> state(static_cast<size_t>(size), 0.0);
+            state[static_cast<size_t>(j)] = 1.0;
+            tickCascade(lane.sections, lane.numSections, state.data(), 0.0);
+            for(int r = 0; r < size; ++r)
+                lane.step[static_cast<size_t>(r * size + j)] = state[static_cast<size_t>(r)];
+        }
+    }
+
+    channelStates.resize(static_cast<size_t>(numChannels));
+    for(int ch = 0; ch < numChannels; ++ch)
+        channelStates[static_cast<size_t>(ch)].lane = stereo ? ch : 0;
+
+    reset();
+}
+
+void OfflineRenderer::reset()
+{
+    for(auto& channel : channelStates)
+        channel.state.assign(static_cast<size_t>(2 * lanes[static_cast<size_t>(channel.lane)].numSections), 0.0);
+}
+
+const OfflineRenderer::Matrix& OfflineRenderer::getTransition(Lane& lane, int numSamples)
+{
+    auto found = lane.transitions.find(numSamples);
+    if(found != lane.transitions.end())
+        return found->second;
+
+    const int size = 2 * lane.numSections;
+    Matrix result(static_cast<size_t>(size * size), 0.0);
+    for(int i = 0; i < size; ++i)
+        result[static_cast<size_t>(i * size + i)] = 1.0;
+
+    auto power = lane.step;
+    for(int n = numSamples; n > 0; n >>= 1)
+    {
+        if(n & 1)
+            result = multiply(power, result, size);
+        if(n > 1)
+            power = multiply(power, power, size);
+    }
+
+    return lane.transitions.emplace(numSamples, std::move(result)).first->second;
+}
+
+void OfflineRenderer::filterFromSilence(const Lane& lane, float* data, int numSamples, std::vector<double>& finalState) const noexcept
+{
+    const auto& kernels = getKernels();
+    for(int i = 0; i < lane.numSections; ++i)
+    {
+        BiquadState state;
+        kernels.processBlockRecursive(lane.blockSections[static_cast<size_t>(i)], state, data, numSamples);
+        finalState[static_cast<size_t>(2 * i)] = state.s1;
+        finalState[static_cast<size_t>(2 * i + 1)] = state.s2;
+    }
+}
+
+void OfflineRenderer::addZeroInputResponse(const Lane& lane, std::vector<double> state, float* data, int numSamples) noexcept
+{
+    // The response can't be cut off at the first small state, as a resonant section's state
+    // passes close to zero on every cycle, so wait for a run of quiet samples.
+    int quiet = 0;
+    for(int n = 0; n < numSamples && quiet < numQuietSamples; ++n)
+    {
+        data[n] += static_cast<float>(tickCascade(lane.sections, lane.numSections, state.data(), 0.0));
+
+        double peak = 0.0;
+        for(auto s : state)
+            peak = juce::jmax(peak, std::abs(s));
+
+        quiet = peak < negligibleState ? quiet + 1 : 0;
+    }
+}
+
+void OfflineRenderer::process(float* const* channels, int numSamples, RealtimeWorkerPool& pool)
+{
+    const int numChannels = static_cast<int>(channelStates.size());
+    if(numSamples <= 0 || numChannels == 0)
+        return;
+
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto mid = 0.5f * (channels[0][i] + channels[1][i]);
+            channels[1][i] = 0.5f * (channels[0][i] - channels[1][i]);
+            channels[0][i] = mid;
+        }
+    }
+
+    const int numChunks = (numSamples + chunkLength - 1) / chunkLength;
+    auto getChunkLength = [this, numSamples](int chunk) { return juce::jmin(chunkLength, numSamples - chunk * chunkLength); };
+
+    for(auto& channel : channelStates)
+    {
+        auto size = channel.state.size();
+        channel.zeroStateFinals.assign(static_cast<size_t>(numChunks), std::vector<double>(size, 0.0));
+        channel.starts.assign(static_cast<size_t>(numChunks), std::vector<double>(size, 0.0));
+    }
+
+    // 1. Every chunk from silence.
+    auto filterChunk = [&](int task)
+    {
+        auto chunk = task / numChannels;
+        auto& channel = channelStates[static_cast<size_t>(task % numChannels)];
+        filterFromSilence(lanes[static_cast<size_t>(channel.lane)],
+                          channels[task % numChannels] + chunk * chunkLength,
+                          getChunkLength(chunk),
+                          channel.zeroStateFinals[static_cast<size_t>(chunk)]);
+    };
+    pool.run(numChunks * numChannels, filterChunk);
+
+    // 2. The true starting state of every chunk.
+    for(auto& channel : channelStates)
+    {
+        auto& lane = lanes[static_cast<size_t>(channel.lane)];
+        const int size = 2 * lane.numSections;
+
+        for(int chunk = 0; chunk < numChunks; ++chunk)
+        {
+            channel.starts[static_cast<size_t>(chunk)] = channel.state;
+
+            const auto& transition = getTransition(lane, getChunkLength(chunk));
+            const auto& zeroStateFinal = channel.zeroStateFinals[static_cast<size_t>(chunk)];
+            std::vector<double> next(zeroStateFinal);
+            for(int r = 0; r < size; ++r)
+                for(int c = 0; c < size; ++c)
+                    next[static_cast<size_t>(r)] += transition[static_cast<size_t>(r * size + c)] * channel.state[static_cast<size_t>(c)];
+
+            channel.state = std::move(next);
+        }
+    }
+
+    // 3. Add each chunk's zero-input response.
+    auto correctChunk = [&](int task)
+    {
+        auto chunk = task / numChannels;
+        auto& channel = channelStates[static_cast<size_t>(task % numChannels)];
+        addZeroInputResponse(lanes[static_cast<size_t>(channel.lane)],
+                             channel.starts[static_cast<size_t>(chunk)],
+                             channels[task % numChannels] + chunk * chunkLength,
+                             getChunkLength(chunk));
+    };
+    pool.run(numChunks * numChannels, correctChunk);
+
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto left = channels[0][i] + channels[1][i];
+            channels[1][i] = channels[0][i] - channels[1][i];
+            channels[0][i] = left;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/*
+  ==============================================================================
+
+    Chunk-parallel offline rendering.
+
+    A cascade of biquads is a linear system, so filtering a chunk that starts
+    from state S gives the same result as filtering it from silence and adding
+    the cascade's zero-input response to S. process() uses that to spread one
+    long signal over every core:
+
+      1. every chunk of every channel is filtered from silence, in parallel,
+         keeping each chunk's final state;
+      2. the true starting state of each chunk is propagated sequentially,
+         S[k + 1] = A^N S[k] + Z[k], with A^N, the cascade's N-sample
+         zero-input state transition, computed in double by repeated squaring;
+      3. the zero-input response of each chunk's true starting state is added,
+         in parallel and in double, until it has decayed below rounding.
+
+    Pass 2 is a handful of small matrix products per chunk and pass 3 only
+    touches the head of each chunk, so the render costs little more than one
+    pass spread over the worker pool. The result matches a sequential render
+    to within floating-point rounding.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+class OfflineRenderer
+{
+public:
+    // The channels are filtered as the plug-in filters a bus of numChannels channels.
+    OfflineRenderer(const ChainCoefficients& coefficients, int numChannels, int chunkLength = 1 << 16);
+
+    // Filters the next numSamples of every channel in place, continuing from the state the
+    // previous call left, so a long file can be rendered in segments.
+    void process(float* const* channels, int numSamples, RealtimeWorkerPool& pool);
+
+    // Back to silence.
+    void reset();
+
+private:
+    // A square matrix over the 2 * numSections states of a lane, row major.
+    using Matrix = std::vector<double>;
+
+    struct Lane
+    {
+        int numSections = 0;
+        std::array<BiquadCoefficients, maxChainSections> sections;
+        std::vector<BlockCoefficients> blockSections;
+        Matrix step;                            // one sample of zero-input evolution
+        std::map<int, Matrix> transitions;      // step^n, by n
+    };
+
+    struct Channel
+    {
+        int lane = 0;
+        std::vector<double> state;              // carried over between process() calls
+        std::vector<std::vector<double>> zeroStateFinals, starts;
+    };
+
+    const Matrix& getTransition(Lane& lane, int numSamples);
+    void filterFromSilence(const Lane& lane, float* data, int numSamples, std::vector<double>& finalState) const noexcept;
+    static void addZeroInputResponse(const Lane& lane, std::vector<double> state, float* data, int numSamples) noexcept;
+
+    std::array<Lane, StereoCascade::numLanes> lanes;
+    std::vector<Channel> channelStates;
+    bool midSide = false;
+    int chunkLength;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OfflineRenderer)
+};
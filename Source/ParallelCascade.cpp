@@ -0,0 +1,641 @@
+/*
+  ==============================================================================
+
+    The cascade as a sum of second order sections.
+
+  ==============================================================================
+*/
+
+#include "ParallelCascade.h"
+
+namespace
+{
+    using Complex = std::complex<double>;
+
+    struct SeriesSection
+    {
+        double b0, b1, b2, a1, a2;
+        int order;
+
+        Complex numerator(Complex w) const noexcept   { return b0 + w * (b1 + w * b2); }
+        Complex denominator(Complex w) const noexcept { return 1.0 + w * (a1 + w * a2); }
+    };
+
+    // A pole of the series chain. A complex pole stands for its conjugate as well.
+    struct Pole
+    {
+        Complex p;
+        int section;
+        Complex otherFactor;                  // 1 - q / p for the section's other pole q, or 1
+        std::vector<Complex> zeroInputGains;  // how much of the section's state reaches this pole, by section
+        Complex residue;
+    };
+
+    // A parallel section's s1 and s2 (or numerator) from the residues of its poles. A real pole
+    // alone is a first order section.
+    std::pair<double, double> combineResidues(const Pole& first, const Pole* second, Complex c1, Complex c2) noexcept
+    {
+        if(first.p.imag() != 0.0)
+            return { 2.0 * c1.real(), -2.0 * (c1 * std::conj(first.p)).real() };
+
+        if(second == nullptr)
+            return { c1.real(), 0.0 };
+
+        return { c1.real() + c2.real(), -(c1.real() * second->p.real() + c2.real() * first.p.real()) };
+    }
+
+    // Gauss-Jordan with partial pivoting; returns false if a is singular.
+    bool invert(std::vector<double>& a, int size)
+    {
+        std::vector<double> inverse(static_cast<size_t>(size * size), 0.0);
+        for(int i = 0; i < size; ++i)
+            inverse[static_cast<size_t>(i * size + i)] = 1.0;
+
+        auto at = [size](std::vector<double>& m, int r, int c) -> double& { return m[static_cast<size_t>(r * size + c)]; };
+
+        double scale = 0.0;
+        for(auto x : a)
+            scale = juce::jmax(scale, std::abs(x));
+
+        for(int c = 0; c < size; ++c)
+        {
+            int pivot = c;
+            for(int r = c + 1; r < size; ++r)
+                if(std::abs(at(a, r, c)) > std::abs(at(a, pivot, c)))
+                    pivot = r;
+
+            if(std::abs(at(a, pivot, c)) <= 1.0e-13 * scale)
+                return false;
+
+            for(int k = 0; k < size; ++k)
+            {
+                std::swap(at(a, c, k), at(a, pivot, k));
+                std::swap(at(inverse, c, k), at(inverse, pivot, k));
+            }
+
+            const auto d = 1.0 / at(a, c, c);
+            for(int k = 0; k < size; ++k)
+            {
+                at(a, c, k) *= d;
+                at(inverse, c, k) *= d;
+            }
+
+            for(int r = 0; r < size; ++r)
+            {
+                const auto f = at(a, r, c);
+                if(r == c || f == 0.0)
+                    continue;
+                for(int k = 0; k < size; ++k)
+                {
+                    at(a, r, k) -= f * at(a, c, k);
+                    at(inverse, r, k) -= f * at(inverse, c, k);
+                }
+            }
+        }
+
+        a = std::move(inverse);
+        return true;
+    }
+
+    // The L1 norms of the differences between the series chain's impulse response in double
+    // and, run in float, the lane's in parallel form and the series chain's own.
+    struct Errors
+    {
+        double parallel = 0, series = 0;
+    };
+
+    Errors measureErrors(const ParallelForm::Lane& lane, const std::vector<SeriesSection>& series)
+    {
+        constexpr int minLength = 64, maxLength = 1 << 18;
+        constexpr double negligibleState = 1.0e-12;
+        constexpr int size = ParallelForm::registerSize;
+
+        std::vector<double> seriesStates(2 * series.size(), 0.0);
+        std::vector<float> floatStates(2 * series.size(), 0.f);
+        std::vector<float> s1(static_cast<size_t>(lane.numGroups * size), 0.f), s2(s1);
+        Errors errors;
+
+        for(int n = 0; n < maxLength; ++n)
+        {
+            const float x = n == 0 ? 1.f : 0.f;
+            double y = x, peak = 0.0;
+            float floatY = x;
+
+            for(size_t j = 0; j < series.size(); ++j)
+            {
+                const auto& c = series[j];
+                auto* s = seriesStates.data() + 2 * j;
+                auto in = y;
+                y = c.b0 * in + s[0];
+                s[0] = c.b1 * in - c.a1 * y + s[1];
+                s[1] = c.b2 * in - c.a2 * y;
+                peak = juce::jmax(peak, std::abs(s[0]), std::abs(s[1]));
+
+                // The coefficients came from float, so this is what the series cascade runs.
+                auto* f = floatStates.data() + 2 * j;
+                auto floatIn = floatY;
+                floatY = static_cast<float>(c.b0) * floatIn + f[0];
+                f[0] = static_cast<float>(c.b1) * floatIn - static_cast<float>(c.a1) * floatY + f[1];
+                f[1] = static_cast<float>(c.b2) * floatIn - static_cast<float>(c.a2) * floatY;
+            }
+
+            float sum = 0.f;
+            for(int g = 0; g < lane.numGroups; ++g)
+            {
+                const auto& group = lane.groups[static_cast<size_t>(g)];
+                for(int r = 0; r < size; ++r)
+                {
+                    auto k = static_cast<size_t>(g * size + r);
+                    auto out = group.b0[r] * x + s1[k];
+                    s1[k] = group.b1[r] * x - group.a1[r] * out + s2[k];
+                    s2[k] = -group.a2[r] * out;
+                    sum += out;
+                    peak = juce::jmax(peak, static_cast<double>(std::abs(s1[k])), static_cast<double>(std::abs(s2[k])));
+                }
+            }
+
+            errors.parallel += std::abs(lane.direct * x + sum - y);
+            errors.series += std::abs(floatY - y);
+
+            if(n >= minLength && peak < negligibleState)
+                break;
+        }
+
+        return errors;
+    }
+
+    bool designLane(const std::array<BiquadCoefficients, maxChainSections>& sections, int numSections,
+                    ParallelForm::Lane& lane, double& error)
+    {
+        constexpr int size = ParallelForm::registerSize;
+
+        // 1. The poles of every section. A section without poles (or with more zeros than
+        //    poles) has no place in a sum of proper fractions.
+        std::vector<SeriesSection> series;
+        std::vector<Pole> poles;
+        double direct = 1.0;
+
+        for(int j = 0; j < numSections; ++j)
+        {
+            const auto& c = sections[static_cast<size_t>(j)];
+            SeriesSection s { c.b0, c.b1, c.b2, c.a1, c.a2, c.a2 != 0.f ? 2 : (c.a1 != 0.f ? 1 : 0) };
+
+            if(s.order == 0 || (s.order == 1 && s.b2 != 0.0))
+                return false;
+
+            direct *= s.order == 2 ? s.b2 / s.a2 : s.b1 / s.a1;
+            series.push_back(s);
+
+            if(s.order == 1)
+            {
+                poles.push_back({ Complex(-s.a1), j, 1.0, {}, {} });
+                continue;
+            }
+
+            const auto discriminant = s.a1 * s.a1 - 4.0 * s.a2;
+            if(discriminant < 0.0)
+            {
+                Complex p(-0.5 * s.a1, 0.5 * std::sqrt(-discriminant));
+                poles.push_back({ p, j, 1.0 - std::conj(p) / p, {}, {} });
+            }
+            else if(discriminant > 0.0)
+            {
+                // The root further from zero first, and the other from the product, so neither cancels.
+                auto q = -0.5 * (s.a1 + std::copysign(std::sqrt(discriminant), s.a1));
+                Complex p1(q), p2(s.a2 / q);
+                poles.push_back({ p1, j, 1.0 - p2 / p1, {}, {} });
+                poles.push_back({ p2, j, 1.0 - p1 / p2, {}, {} });
+            }
+            else
+            {
+                return false;   // a double pole
+            }
+        }
+
+        // 2. The residues, of the transfer function and of the zero-input response of each
+        //    section's state. For the pole p, at w = 1 / p,
+        //        gain[j] = prod_{m > j} N_m(w) / prod_{poles q of sections m >= j, q != p} (1 - q w)
+        //    for every section j up to p's own, the residue of H is N_0(w) gain[0], and a state
+        //    (s1, s2) of section j contributes (s1 + s2 w) gain[j].
+        for(auto& pole : poles)
+        {
+            const auto w = 1.0 / pole.p;
+            pole.zeroInputGains.assign(series.size(), 0.0);
+
+            Complex gain = 1.0 / pole.otherFactor;
+            for(size_t m = static_cast<size_t>(pole.section) + 1; m < series.size(); ++m)
+                gain *= series[m].numerator(w) / series[m].denominator(w);
+
+            for(int j = pole.section; j >= 0; --j)
+            {
+                if(! std::isfinite(std::abs(gain)))
+                    return false;
+
+                pole.zeroInputGains[static_cast<size_t>(j)] = gain;
+                if(j > 0)
+                    gain *= series[static_cast<size_t>(j)].numerator(w) / series[static_cast<size_t>(j - 1)].denominator(w);
+            }
+
+            pole.residue = series[0].numerator(w) * pole.zeroInputGains[0];
+        }
+
+        // 3. One parallel section per complex pole, per pair of real poles and for a real pole
+        //    left over.
+        struct ParallelSection
+        {
+            const Pole* first;
+            const Pole* second;
+        };
+        std::vector<ParallelSection> parallel;
+        const Pole* unpaired = nullptr;
+
+        for(const auto& pole : poles)
+        {
+            if(pole.p.imag() != 0.0)
+                parallel.push_back({ &pole, nullptr });
+            else if(unpaired == nullptr)
+                unpaired = &pole;
+            else
+            {
+                parallel.push_back({ unpaired, &pole });
+                unpaired = nullptr;
+            }
+        }
+        if(unpaired != nullptr)
+            parallel.push_back({ unpaired, nullptr });
+
+        lane.numGroups = (static_cast<int>(parallel.size()) + size - 1) / size;
+        lane.direct = static_cast<float>(direct);
+        lane.groups = {};
+
+        for(size_t k = 0; k < parallel.size(); ++k)
+        {
+            const auto& section = parallel[k];
+            auto& group = lane.groups[k / size];
+            const auto r = k % size;
+
+            auto numerator = combineResidues(*section.first, section.second, section.first->residue,
+                                             section.second != nullptr ? section.second->residue : Complex());
+            group.b0[r] = static_cast<float>(numerator.first);
+            group.b1[r] = static_cast<float>(numerator.second);
+
+            if(section.first->p.imag() != 0.0)
+            {
+                group.a1[r] = static_cast<float>(-2.0 * section.first->p.real());
+                group.a2[r] = static_cast<float>(std::norm(section.first->p));
+            }
+            else if(section.second != nullptr)
+            {
+                group.a1[r] = static_cast<float>(-(section.first->p.real() + section.second->p.real()));
+                group.a2[r] = static_cast<float>(section.first->p.real() * section.second->p.real());
+            }
+            else
+            {
+                group.a1[r] = static_cast<float>(-section.first->p.real());
+            }
+        }
+
+        // 4. The state maps. Column by column: the parallel states a single series state becomes.
+        const int numSeriesStates = 2 * numSections;
+        const int numParallelStates = lane.getNumStates();
+        lane.numSeriesStates = numSeriesStates;
+        lane.toParallel.assign(static_cast<size_t>(numParallelStates * numSeriesStates), 0.0);
+
+        for(int j = 0; j < numSections; ++j)
+        {
+            for(int t = 0; t < 2; ++t)
+            {
+                const int column = 2 * j + t;
+                auto contribution = [j, t](const Pole* pole)
+                {
+                    if(pole == nullptr)
+                        return Complex();
+                    auto gain = pole->zeroInputGains[static_cast<size_t>(j)];
+                    return t == 0 ? gain : gain / pole->p;
+                };
+
+                for(size_t k = 0; k < parallel.size(); ++k)
+                {
+                    const auto& section = parallel[k];
+                    auto states = combineResidues(*section.first, section.second,
+                                                  contribution(section.first), contribution(section.second));
+                    lane.toParallel[(2 * k) * static_cast<size_t>(numSeriesStates) + static_cast<size_t>(column)] = states.first;
+                    lane.toParallel[(2 * k + 1) * static_cast<size_t>(numSeriesStates) + static_cast<size_t>(column)] = states.second;
+                }
+            }
+        }
+
+        // The map back only covers the states that carry anything: s2 of a first order section
+        // stays zero in either form.
+        std::vector<int> seriesIndices, parallelIndices;
+        for(int j = 0; j < numSections; ++j)
+        {
+            seriesIndices.push_back(2 * j);
+            if(series[static_cast<size_t>(j)].order == 2)
+                seriesIndices.push_back(2 * j + 1);
+        }
+        for(size_t k = 0; k < parallel.size(); ++k)
+        {
+            parallelIndices.push_back(static_cast<int>(2 * k));
+            if(parallel[k].first->p.imag() != 0.0 || parallel[k].second != nullptr)
+                parallelIndices.push_back(static_cast<int>(2 * k + 1));
+        }
+        jassert(seriesIndices.size() == parallelIndices.size());
+
+        const int reduced = static_cast<int>(seriesIndices.size());
+        std::vector<double> map(static_cast<size_t>(reduced * reduced));
+        for(int r = 0; r < reduced; ++r)
+            for(int c = 0; c < reduced; ++c)
+                map[static_cast<size_t>(r * reduced + c)] = lane.toParallel[static_cast<size_t>(parallelIndices[static_cast<size_t>(r)] * numSeriesStates
+                                                                                                + seriesIndices[static_cast<size_t>(c)])];
+
+        if(! invert(map, reduced))
+            return false;
+
+        lane.toSeries.assign(static_cast<size_t>(numSeriesStates * numParallelStates), 0.0);
+        for(int r = 0; r < reduced; ++r)
+            for(int c = 0; c < reduced; ++c)
+                lane.toSeries[static_cast<size_t>(seriesIndices[static_cast<size_t>(r)] * numParallelStates
+                                                  + parallelIndices[static_cast<size_t>(c)])] = map[static_cast<size_t>(r * reduced + c)];
+
+        // 5. How well it all survived.
+        auto errors = measureErrors(lane, series);
+        error = errors.parallel;
+        return errors.parallel <= juce::jmax(ParallelForm::tolerance, ParallelForm::maxErrorRatio * errors.series);
+    }
+}
+
+bool ParallelForm::design(const ChainCoefficients& coefficients)
+{
+    valid = false;
+    error = 0;
+    stereoMode = coefficients.stereoMode;
+
+    for(int l = 0; l < StereoCascade::numLanes; ++l)
+    {
+        std::array<BiquadCoefficients, maxChainSections> sections;
+        auto numSections = coefficients.getSections(l, sections);
+
+        double laneError = 0;
+        auto designed = designLane(sections, numSections, lanes[static_cast<size_t>(l)], laneError);
+        error = juce::jmax(error, laneError);
+
+        if(! designed)
+            return false;
+    }
+
+    valid = true;
+    return true;
+}
+
+//==============================================================================
+size_t ParallelCascade::getArenaSize(int numChannels) noexcept
+{
+    return InstanceArena::getSize<PairStates>(static_cast<size_t>((juce::jmax(1, numChannels) + 1) / 2));
+}
+
+void ParallelCascade::prepare(int numChannels, InstanceArena& arena)
+{
+    pairStates = arena.allocate<PairStates>(static_cast<size_t>((juce::jmax(1, numChannels) + 1) / 2));
+    form = nullptr;
+}
+
+void ParallelCascade::takeOver(const ParallelForm& newForm, const StereoCascade& series) noexcept
+{
+    form = &newForm;
+
+    for(int lane = 0; lane < numLanes; ++lane)
+        laneFunctions[static_cast<size_t>(lane)] = getLaneFunction(form->lanes[static_cast<size_t>(lane)].numGroups);
+
+    StereoCascade::ChainStates chainStates;
+    for(size_t pair = 0; pair < pairStates.size(); ++pair)
+    {
+        series.getChainStates(static_cast<int>(pair), chainStates);
+
+        for(int l = 0; l < numLanes; ++l)
+        {
+            const auto& lane = form->lanes[static_cast<size_t>(l)];
+            const auto& from = chainStates[static_cast<size_t>(l)];
+            auto& to = pairStates[pair].lanes[static_cast<size_t>(l)];
+
+            for(int r = 0; r < lane.getNumStates(); ++r)
+            {
+                const auto* row = lane.toParallel.data() + static_cast<size_t>(r * lane.numSeriesStates);
+                double state = 0.0;
+                for(int c = 0; c < lane.numSeriesStates; ++c)
+                    state += row[c] * from[static_cast<size_t>(c)];
+
+                (r % 2 == 0 ? to.s1 : to.s2)[static_cast<size_t>(r / 2)] = static_cast<float>(state);
+            }
+        }
+    }
+}
+
+void ParallelCascade::handBack(StereoCascade& series) noexcept
+{
+    if(form == nullptr)
+        return;
+
+    StereoCascade::ChainStates chainStates;
+    for(size_t pair = 0; pair < pairStates.size(); ++pair)
+    {
+        for(int l = 0; l < numLanes; ++l)
+        {
+            const auto& lane = form->lanes[static_cast<size_t>(l)];
+            const auto& from = pairStates[pair].lanes[static_cast<size_t>(l)];
+            auto& to = chainStates[static_cast<size_t>(l)];
+
+            for(int r = 0; r < lane.numSeriesStates; ++r)
+            {
+                const auto* row = lane.toSeries.data() + static_cast<size_t>(r * lane.getNumStates());
+                double state = 0.0;
+                for(int c = 0; c < lane.getNumStates(); ++c)
+                    state += row[c] * (c % 2 == 0 ? from.s1 : from.s2)[static_cast<size_t>(c / 2)];
+
+                to[static_cast<size_t>(r)] = state;
+            }
+        }
+
+        series.setChainStates(static_cast<int>(pair), chainStates);
+    }
+
+    form = nullptr;
+}
+
+template<int... Group>
+void ParallelCascade::processLane(const ParallelForm::Lane& lane, LaneStates& states, float* data, int numSamples,
+                                  std::integer_sequence<int, Group...>) noexcept
+{
+    constexpr int numGroups = static_cast<int>(sizeof...(Group));
+
+    // Everything stays in registers for the whole block; the groups only meet in the sum.
+    Register b0[numGroups], b1[numGroups], a1[numGroups], minusA2[numGroups], s1[numGroups], s2[numGroups];
+    auto load = [&](int g)
+    {
+        const auto& group = lane.groups[static_cast<size_t>(g)];
+        b0[g] = Register::fromRawArray(group.b0);
+        b1[g] = Register::fromRawArray(group.b1);
+        a1[g] = Register::fromRawArray(group.a1);
+        minusA2[g] = Register::expand(0.f) - Register::fromRawArray(group.a2);
+        s1[g] = Register::fromRawArray(states.s1.data() + g * registerSize);
+        s2[g] = Register::fromRawArray(states.s2.data() + g * registerSize);
+    };
+    (load(Group), ...);
+
+    const auto direct = lane.direct;
+
+    for(int i = 0; i < numSamples; ++i)
+    {
+        const auto x = Register::expand(data[i]);
+        Register sum = Register::expand(0.f);
+
+        auto tick = [&](int g)
+        {
+            auto y = b0[g] * x + s1[g];
+            s1[g] = b1[g] * x - a1[g] * y + s2[g];
+            s2[g] = minusA2[g] * y;
+            sum += y;
+        };
+        (tick(Group), ...);
+
+        data[i] = direct * data[i] + sum.sum();
+    }
+
+    auto store = [&](int g)
+    {
+        s1[g].copyToRawArray(states.s1.data() + g * registerSize);
+        s2[g].copyToRawArray(states.s2.data() + g * registerSize);
+    };
+    (store(Group), ...);
+}
+
+template<int NumGroups>
+void ParallelCascade::processLane(const ParallelForm::Lane& lane, LaneStates& states, float* data, int numSamples) noexcept
+{
+    if constexpr (NumGroups == 0)
+        juce::FloatVectorOperations::multiply(data, lane.direct, numSamples);
+    else
+        processLane(lane, states, data, numSamples, std::make_integer_sequence<int, NumGroups>());
+}
+
+ParallelCascade::LaneFunction ParallelCascade::getLaneFunction(int numGroups)
+{
+    static const auto functions = makeLaneFunctions(std::make_index_sequence<ParallelForm::maxGroups + 1>());
+    return functions[static_cast<size_t>(juce::jlimit(0, ParallelForm::maxGroups, numGroups))];
+}
+
+template<size_t... NumGroups>
+std::array<ParallelCascade::LaneFunction, sizeof...(NumGroups)> ParallelCascade::makeLaneFunctions(std::index_sequence<NumGroups...>) noexcept
+{
+    return { { &processLane<static_cast<int>(NumGroups)>... } };
+}
+
+void ParallelCascade::process(int pair, float* left, float* right, int numSamples) noexcept
+{
+    auto& states = pairStates[static_cast<size_t>(pair)].lanes;
+
+    if(right == nullptr)
+    {
+        laneFunctions[0](form->lanes[0], states[0], left, numSamples);
+        return;
+    }
+
+    const bool midSide = form->stereoMode == Stereo_MidSide;
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto mid = 0.5f * (left[i] + right[i]);
+            right[i] = 0.5f * (left[i] - right[i]);
+            left[i] = mid;
+        }
+    }
+
+    laneFunctions[0](form->lanes[0], states[0], left, numSamples);
+    laneFunctions[1](form->lanes[1], states[1], right, numSamples);
+
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto l = left[i] + right[i];
+            right[i] = left[i] - right[i];
+            left[i] = l;
+        }
+    }
+}
+
+//==============================================================================
+ParallelFormDesigner::ParallelFormDesigner(FiveBandEQAudioProcessor& p)
+    : processor(p)
+{
+}
+
+ParallelFormDesigner::~ParallelFormDesigner()
+{
+    stop();
+}
+
+void ParallelFormDesigner::start()
+{
+    if(! worker.isThreadRunning())
+        worker.startThread();
+}
+
+void ParallelFormDesigner::stop()
+{
+    if(! worker.isThreadRunning())
+        return;
+
+    worker.signalThreadShouldExit();
+    wakeUp.post();
+    worker.stopThread(2000);
+}
+
+void ParallelFormDesigner::requestDesign() noexcept
+{
+    if(! designPending.exchange(true, std::memory_order_acq_rel))
+        wakeUp.post();
+}
+
+const ParallelForm& ParallelFormDesigner::getLatest() noexcept
+{
+    if((middle.load(std::memory_order_relaxed) & freshBit) != 0)
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~freshBit;
+
+    return forms[static_cast<size_t>(front)];
+}
+
+void ParallelFormDesigner::Worker::run()
+{
+    while(! threadShouldExit())
+    {
+        designer.wakeUp.wait();
+
+        // Cleared before designing, so a request made meanwhile posts again and is not lost.
+        if(designer.designPending.exchange(false, std::memory_order_acq_rel))
+            designer.designIfChanged();
+    }
+}
+
+void ParallelFormDesigner::designIfChanged()
+{
+    // Only the newest layout matters: anything published while this one was designed is
+    // picked up on the next pass.
+    if(! processor.readCoefficientSnapshot(snapshot, snapshotVersion) || snapshot.layoutVersion == designedLayout)
+        return;
+
+    auto& form = forms[static_cast<size_t>(back)];
+    form.design(snapshot.coefficients);
+    form.layoutVersion = snapshot.layoutVersion;
+    designedLayout = snapshot.layoutVersion;
+
+    // Only this thread resizes the maps, so reading the others' sizes here is safe.
+    size_t numBytes = 0;
+    for(const auto& f : forms)
+        for(const auto& lane : f.lanes)
+            numBytes += (lane.toParallel.capacity() + lane.toSeries.capacity()) * sizeof(double);
+    allocatedBytes.store(numBytes, std::memory_order_relaxed);
+
+    back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & ~freshBit;
+}
@@ -0,0 +1,214 @@
+/*
+  ==============================================================================
+
+    The cascade as a sum of second order sections.
+
+    In the series cascade each section has to wait for the one ahead of it,
+    so every sample waits on the whole chain in turn. Expanding a lane's
+    whole transfer function into partial fractions,
+
+        H(z) = d + sum_k r_k / (1 - p_k z^-1),
+
+    and pairing each pole with its conjugate (or two real poles together)
+    gives the same response as a set of second order sections that all
+    filter the input directly, plus the direct gain d. The sections are
+    independent, so they sit side by side in the lanes of a SIMD register and
+    all advance in the same few instructions per sample; only their outputs
+    are summed.
+
+    The poles are those of the series sections, so nothing needs a root
+    finder, but coincident or very close poles (two identical bands, a steep
+    cut very low down) make the residues large, and they then cancel badly
+    in float. ParallelForm::design() measures the result against the series
+    chain and refuses it when the impulse responses differ by more than
+    ParallelForm::tolerance; the processor then keeps running the series
+    cascade.
+
+    A form also maps the series chain's states onto its own (the residues of
+    the series zero-input response) and back, so switching between the two
+    keeps the filters' memory. Parameter changes always go back to the series
+    cascade, which knows how each section's state carries over, and the new
+    layout's parallel form takes over again once the designer thread has it.
+    The designer sleeps until the audio thread asks for a form, so it costs
+    nothing while the parallel form isn't wanted.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "RealtimeWorkerPool.h"
+
+// Both lanes of a layout in parallel form. Designed off the audio thread.
+struct ParallelForm
+{
+    using Register = juce::dsp::SIMDRegister<float>;
+    static constexpr int registerSize = static_cast<int>(Register::size());
+
+    // A lane has at most one section per series section.
+    static constexpr int maxSections = maxChainSections;
+    static constexpr int maxGroups = (maxSections + registerSize - 1) / registerSize;
+    static constexpr int maxStates = 2 * maxSections;
+
+    // A form is accepted when the L1 difference between its impulse response, run in float,
+    // and the series chain's, run in double, is at most tolerance (-80 dB) or at most
+    // maxErrorRatio times the series cascade's own float error, whichever is larger. No input
+    // can make the outputs differ by more than that times its peak. Low cuts of 24 dB/oct or
+    // more below about 100 Hz usually fail and stay in series.
+    static constexpr double tolerance = 1.0e-4;
+    static constexpr double maxErrorRatio = 2.0;
+
+    // registerSize sections side by side, each y = b0 x + s1, s1 = b1 x - a1 y + s2, s2 = -a2 y.
+    // Lanes without a section are all zero.
+    struct Group
+    {
+        alignas(32) float b0[registerSize], b1[registerSize], a1[registerSize], a2[registerSize];
+    };
+
+    struct Lane
+    {
+        std::array<Group, maxGroups> groups;
+        int numGroups = 0;
+        float direct = 0;
+
+        // The series chain's states are the two of each section in ChainCoefficients::getSections()
+        // order, the parallel ones s1 and s2 of each section in turn. Row major, in double.
+        int numSeriesStates = 0;
+        std::vector<double> toParallel;   // 2 * registerSize * numGroups rows, numSeriesStates columns
+        std::vector<double> toSeries;     // numSeriesStates rows, 2 * registerSize * numGroups columns
+
+        int getNumStates() const noexcept { return 2 * registerSize * numGroups; }
+    };
+
+    std::array<Lane, StereoCascade::numLanes> lanes;
+    StereoMode stereoMode { Stereo_Linked };
+
+    juce::uint32 layoutVersion = 0;   // CoefficientSnapshot::layoutVersion of the layout it was designed from
+    bool valid = false;
+    double error = 0;                 // the measured difference, for the tools
+
+    // Returns false, leaving valid false, when a lane has coincident poles or the result
+    // isn't within tolerance. Allocates.
+    bool design(const ChainCoefficients& coefficients);
+};
+
+// Runs a ParallelForm over the pairs of a bus, as StereoCascade does with the series chain.
+class ParallelCascade
+{
+public:
+    static constexpr int numLanes = StereoCascade::numLanes;
+
+    // The arena space prepare() takes for a bus of numChannels channels.
+    static size_t getArenaSize(int numChannels) noexcept;
+
+    // Carves the states for a bus of numChannels channels from arena and stops. Not real-time safe.
+    void prepare(int numChannels, InstanceArena& arena);
+
+    bool isRunning() const noexcept { return form != nullptr; }
+
+    // Maps series's states onto form's sections and starts running form, which has to stay
+    // untouched until handBack() or stop(). series must have the layout form was designed from.
+    void takeOver(const ParallelForm& form, const StereoCascade& series) noexcept;
+
+    // Maps the states back onto series, which must still have the layout the form was
+    // designed from, and stops.
+    void handBack(StereoCascade& series) noexcept;
+
+    // Stops without handing anything back.
+    void stop() noexcept { form = nullptr; }
+
+    // As StereoCascade::process(). Different pairs may be processed concurrently.
+    void process(int pair, float* left, float* right, int numSamples) noexcept;
+
+private:
+    using Register = ParallelForm::Register;
+    static constexpr int registerSize = ParallelForm::registerSize;
+
+    struct LaneStates
+    {
+        alignas(32) std::array<float, ParallelForm::maxGroups * registerSize> s1, s2;
+    };
+
+    struct alignas(64) PairStates
+    {
+        std::array<LaneStates, numLanes> lanes {};
+    };
+
+    using LaneFunction = void (*)(const ParallelForm::Lane&, LaneStates&, float*, int);
+
+    template<int NumGroups>
+    static void processLane(const ParallelForm::Lane& lane, LaneStates& states, float* data, int numSamples) noexcept;
+    template<int... Group>
+    static void processLane(const ParallelForm::Lane& lane, LaneStates& states, float* data, int numSamples,
+                            std::integer_sequence<int, Group...>) noexcept;
+    static LaneFunction getLaneFunction(int numGroups);
+    template<size_t... NumGroups>
+    static std::array<LaneFunction, sizeof...(NumGroups)> makeLaneFunctions(std::index_sequence<NumGroups...>) noexcept;
+
+    const ParallelForm* form = nullptr;
+    std::array<LaneFunction, numLanes> laneFunctions {};
+    ArenaArray<PairStates> pairStates;
+};
+
+// Designs the parallel form of whatever the processor publishes, on its own thread, and
+// hands the results to the audio thread through a triple buffer, so neither side ever waits
+// or copies a form.
+class ParallelFormDesigner
+{
+public:
+    explicit ParallelFormDesigner(FiveBandEQAudioProcessor& processor);
+    ~ParallelFormDesigner();
+
+    // Not real-time safe. The thread sleeps until a design is requested, so it can be
+    // started with playback whether or not the parallel form is wanted.
+    void start();
+    void stop();
+
+    // Audio thread. Wakes the thread to design the newest published layout, unless a
+    // request is already pending. Requests made while the thread is stopped are served
+    // once it starts.
+    void requestDesign() noexcept;
+
+    // Audio thread. The newest form, or the same one as last time if nothing newer has been
+    // designed since. It stays untouched until the next call.
+    const ParallelForm& getLatest() noexcept;
+
+    // Any thread. What the forms' state maps hold, as of the last design.
+    size_t getAllocatedBytes() const noexcept { return allocatedBytes.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker : juce::Thread
+    {
+        Worker(ParallelFormDesigner& owner) : juce::Thread("Parallel form"), designer(owner) {}
+        void run() override;
+        ParallelFormDesigner& designer;
+    };
+
+    void designIfChanged();
+
+    FiveBandEQAudioProcessor& processor;
+
+    // The worker owns back, the audio thread front, and they swap through middle, whose
+    // freshBit says the worker has put a new form there.
+    static constexpr int freshBit = 4;
+    std::array<ParallelForm, 3> forms;
+    int back = 0, front = 2;
+    std::atomic<int> middle { 1 };
+
+    // Worker thread only.
+    CoefficientSnapshot snapshot;
+    juce::uint32 snapshotVersion = 0, designedLayout = 0;
+
+    std::atomic<size_t> allocatedBytes { 0 };
+
+    // Posted at most once per pending request, so the count stays bounded however often
+    // the audio thread asks.
+    RealtimeWorkerPool::Semaphore wakeUp;
+    std::atomic<bool> designPending { false };
+
+    Worker worker { *this };
+
+    JUCE_DECLARE_NON_COPYABLE (ParallelFormDesigner)
+};
@@ -8,6 +8,8 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "MatchEQ.h"
+#include "TraceProfiler.h"
 
 void LookAndFeel::drawRotarySlider(juce::Graphics& g,
     int x,
@@ -137,11 +139,17 @@ juce::String RotarySliderWithLabels::getDisplayString() const
 }
 ResponseCurveComponent::ResponseCurveComponent(FiveBandEQAudioProcessor& p) : audioProcessor(p)
 {
+    // Only the parameters the design reads; the others change nothing on the curve.
     const auto& params = audioProcessor.getParameters();
     for(auto param: params){
-        param->addListener(this);
+        if(auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+            if(isChainSettingsParameter(ranged->getParameterID()))
+                param->addListener(this);
     }
 
+    // The processor only designs once it processes, so if nothing has been published by the
+    // time idleTicks run out, draw the current settings from here.
+    parametersChanged.set(true);
     startTimerHz(60);
 }
 ResponseCurveComponent::~ResponseCurveComponent()
@@ -159,79 +167,66 @@ void ResponseCurveComponent::parameterValueChanged(int parameterIndex, float new
 
 void ResponseCurveComponent::timerCallback()
 {
-    if( parametersChanged.compareAndSetBool(false,true))
+    FIVEBANDEQ_TRACE_SCOPE("ResponseCurve timerCallback");
+    if(! background.isNull() && ++ticksSincePaint > hiddenTicks && ! isShowing())
+        background = {};
+
+    const auto numProcessedBlocks = audioProcessor.getNumProcessedBlocks();
+    if(numProcessedBlocks != lastNumProcessedBlocks)
+    {
+        lastNumProcessedBlocks = numProcessedBlocks;
+        ticksSinceProcessed = 0;
+    }
+    else if(ticksSinceProcessed <= idleTicks)
     {
-        //update monochain
-        auto chainSettings=getChainSettings(audioProcessor.apvts);
-        auto peak1Coefficients=makePeak1Filter(chainSettings, audioProcessor.getSampleRate());
-        auto peak2Coefficients=makePeak2Filter(chainSettings, audioProcessor.getSampleRate());
-        auto peak3Coefficients=makePeak3Filter(chainSettings, audioProcessor.getSampleRate());
-        updateCoefficients(monoChain.get<ChainPositions::Peak1>().coefficients,peak1Coefficients);
-        updateCoefficients(monoChain.get<ChainPositions::Peak2>().coefficients,peak2Coefficients);
-        updateCoefficients(monoChain.get<ChainPositions::Peak3>().coefficients,peak3Coefficients);
-        auto lowCutCoefficients= makeLowCutFilter(chainSettings, audioProcessor.getSampleRate());
-        auto highCutCoefficients= makeHighCutFilter(chainSettings, audioProcessor.getSampleRate());
-        updateCutFilter(monoChain.get<ChainPositions::LowCut>(),lowCutCoefficients, chainSettings.lowCutSlope);
-        updateCutFilter(monoChain.get<ChainPositions::HighCut>(),highCutCoefficients, chainSettings.highCutSlope);
-        //signal new draw of response curve
+        ++ticksSinceProcessed;
+    }
+
+    if(audioProcessor.readCoefficientSnapshot(snapshot, snapshotVersion))
+    {
+        parametersChanged.set(false);
+        showingLocalDesign = false;
+        repaint();
+    }
+    else if(parametersChanged.get() && ticksSinceProcessed > idleTicks)
+    {
+        // Nothing has been designed before the first prepareToPlay; try again later.
+        const auto sampleRate = audioProcessor.getSampleRate();
+        if(sampleRate <= 0)
+            return;
+
+        // Nothing is processing, so design the change here from what updateFilters() would
+        // use, and keep it apart from what the processor published.
+        parametersChanged.set(false);
+        localDesign.sampleRate = sampleRate;
+        localDesign.bypassed = snapshot.bypassed;
+        updateChainCoefficients(localDesign.coefficients, audioProcessor.getDesignSettings(), nullptr, sampleRate);
+        showingLocalDesign = true;
         repaint();
     }
 }
 void ResponseCurveComponent::paint (juce::Graphics& g)
 {
+    FIVEBANDEQ_TRACE_SCOPE("ResponseCurve paint");
     using namespace juce;
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll(Colour(40u,40u,40u));
+    ticksSincePaint = 0;
+    if(background.isNull())
+        background = backgrounds->find(jmax(1, getWidth()), jmax(1, getHeight()));
+    if(background.isNull())
+    {
+        renderBackground();
+        backgrounds->add(background);
+    }
     g.drawImage(background, getLocalBounds().toFloat());
     auto responseArea = getAnalysisArea();
 
     auto w=responseArea.getWidth();
 
-    auto& lowcut = monoChain.get<ChainPositions::LowCut>();
-    auto& peak1 = monoChain.get<ChainPositions::Peak1>();
-    auto& peak2 = monoChain.get<ChainPositions::Peak2>();
-    auto& peak3 = monoChain.get<ChainPositions::Peak3>();
-    auto& highcut = monoChain.get<ChainPositions::HighCut>();
-
-    auto sampleRate= audioProcessor.getSampleRate();
-
-    std::vector<double> mags;
-
-    mags.resize(w);
-
-    for(int i=0; i<w; ++i){
-        double mag=1.f;
-        auto freq = mapToLog10(double(i)/double(w), 20.0,20000.0);
-
-        if(! monoChain.isBypassed<ChainPositions::Peak1>() )
-            mag*=peak1.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! monoChain.isBypassed<ChainPositions::Peak2>() )
-            mag*=peak2.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! monoChain.isBypassed<ChainPositions::Peak3>() )
-            mag*=peak3.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-
-        if(! lowcut.isBypassed<0>() )
-            mag*=lowcut.get<0>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! lowcut.isBypassed<1>() )
-            mag*=lowcut.get<1>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! lowcut.isBypassed<2>() )
-            mag*=lowcut.get<2>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! lowcut.isBypassed<3>() )
-            mag*=lowcut.get<3>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-
-        if(! highcut.isBypassed<0>() )
-            mag*=highcut.get<0>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! highcut.isBypassed<1>() )
-            mag*=highcut.get<1>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! highcut.isBypassed<2>() )
-            mag*=highcut.get<2>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if(! highcut.isBypassed<3>() )
-            mag*=highcut.get<3>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-
-        mags[i]=Decibels::gainToDecibels(mag);
-    }
-
-    Path responseCurve;
+    const auto& shown = showingLocalDesign ? localDesign : snapshot;
+    auto sampleRate = shown.sampleRate;
+    const auto& chainCoefficients = shown.coefficients;
 
     const double outputMin = responseArea.getBottom();
     const double outputMax=responseArea.getY();
@@ -240,24 +235,92 @@ void ResponseCurveComponent::paint (juce::Graphics& g)
         return jmap(input, -24.0, 24.0, outputMin, outputMax);
     };
 
-    responseCurve.startNewSubPath(responseArea.getX(), map(mags.front()));
+    // One point per pixel, evaluated for every section at once.
+    const auto numPoints = juce::jmax(0, static_cast<int>(w));
+    std::vector<double> phi(static_cast<size_t>(numPoints)), magnitudesSquared(phi.size());
+    for(int i=0; i<numPoints; ++i)
+        phi[static_cast<size_t>(i)] = getPhi(mapToLog10(double(i)/double(w), 20.0,20000.0), sampleRate);
 
-    for( size_t i=1; i<mags.size(); ++i)
+    // Unless the channels are linked, the second curve is the right (or side) channel.
+    auto makeResponseCurve = [&](int channel)
     {
-        responseCurve.lineTo(responseArea.getX()+i, map(mags[i]));
-    }
+        Path responseCurve;
+        chainCoefficients.getMagnitudesSquared(channel, phi.data(), magnitudesSquared.data(), numPoints);
+
+        for(int i=0; i<numPoints; ++i){
+            auto mag = std::sqrt(magnitudesSquared[static_cast<size_t>(i)]);
+            auto y = map(Decibels::gainToDecibels(mag));
+
+            if(i == 0)
+                responseCurve.startNewSubPath(responseArea.getX(), y);
+            else
+                responseCurve.lineTo(responseArea.getX()+i, y);
+        }
+
+        return responseCurve;
+    };
 
     g.setColour(Colours::white);
     g.drawRoundedRectangle(getRenderArea().toFloat(), 4.f, 1.f);
-    g.setColour(Colours::yellow);
-    g.strokePath(responseCurve, PathStrokeType(2.f));
+
+    // Nothing has been designed before the first prepareToPlay.
+    if(sampleRate <= 0)
+        return;
+
+    // A bypassed processor still shows its curves, dimmed.
+    const auto alpha = shown.bypassed ? 0.35f : 1.f;
+
+    if(chainCoefficients.stereoMode != Stereo_Linked)
+    {
+        g.setColour(Colours::orange.withAlpha(alpha));
+        g.strokePath(makeResponseCurve(1), PathStrokeType(2.f));
+    }
+
+    g.setColour(Colours::yellow.withAlpha(alpha));
+    g.strokePath(makeResponseCurve(0), PathStrokeType(2.f));
 }
 
 
 void ResponseCurveComponent::resized()
 {
+    background = {};
+}
+
+size_t ResponseCurveComponent::getBackgroundBytes() const
+{
+    if(background.isNull())
+        return 0;
+
+    // Every editor holding it pays its part; the cache's own reference doesn't count.
+    const auto numHolders = static_cast<size_t>(juce::jmax(1, background.getReferenceCount() - 1));
+    const juce::Image::BitmapData data(background, juce::Image::BitmapData::readOnly);
+    return static_cast<size_t>(data.lineStride) * static_cast<size_t>(data.height) / numHolders;
+}
+
+juce::Image ResponseCurveBackgrounds::find(int width, int height)
+{
+    // Images only this cache refers to belong to no editor any more.
+    images.erase(std::remove_if(images.begin(), images.end(),
+                                [](const juce::Image& image) { return image.getReferenceCount() <= 1; }),
+                 images.end());
+
+    for(const auto& image : images)
+        if(image.getWidth() == width && image.getHeight() == height)
+            return image;
+
+    return {};
+}
+
+void ResponseCurveBackgrounds::add(const juce::Image& image)
+{
+    images.push_back(image);
+}
+
+void ResponseCurveComponent::renderBackground()
+{
+    FIVEBANDEQ_TRACE_SCOPE("ResponseCurve background");
     using namespace juce;
-    background = Image(Image::PixelFormat::RGB, getWidth(), getHeight(), true);
+    background = Image(Image::PixelFormat::RGB, jmax(1, getWidth()), jmax(1, getHeight()), true);
     Graphics g(background);
 
     Array<float> freqs
@@ -378,72 +441,163 @@ juce::Rectangle<int> ResponseCurveComponent::getAnalysisArea()
     bounds.removeFromBottom(4);
     return bounds;
 }
+LoudnessDisplay::LoudnessDisplay(FiveBandEQAudioProcessor& p) : audioProcessor(p)
+{
+    startTimerHz(10);
+}
+
+void LoudnessDisplay::timerCallback()
+{
+    readings = audioProcessor.getLoudnessSnapshot();
+    repaint();
+}
+
+void LoudnessDisplay::mouseDown(const juce::MouseEvent&)
+{
+    audioProcessor.resetIntegratedLoudness();
+}
+
+void LoudnessDisplay::paint(juce::Graphics& g)
+{
+    using namespace juce;
+    g.fillAll(Colour(40u,40u,40u));
+
+    auto format = [](float loudness)
+    {
+        return loudness > LoudnessMeter::silence ? String(loudness, 1) : String("--");
+    };
+
+    auto describe = [&format](const char* name, const LoudnessMeter::Readings& r)
+    {
+        String str;
+        str << name << "  M " << format(r.momentary) << "  S " << format(r.shortTerm) << "  I " << format(r.integrated) << " LUFS";
+        return str;
+    };
+
+    String gain;
+    gain << "Auto Gain " << (readings.autoGainDecibels > 0 ? "+" : "") << String(readings.autoGainDecibels, 1) << " dB";
+
+    auto bounds = getLocalBounds().reduced(20, 0);
+    auto width = bounds.getWidth() / 3;
+    g.setColour(Colours::white);
+    g.setFont(12);
+    g.drawFittedText(describe("In", readings.input), bounds.removeFromLeft(width), Justification::centredLeft, 1);
+    g.drawFittedText(describe("Out", readings.output), bounds.removeFromLeft(width), Justification::centred, 1);
+    g.drawFittedText(gain, bounds, Justification::centredRight, 1);
+}
+
+BandControls::BandControls(juce::AudioProcessorValueTreeState& apvts, int bandIndex) :
+freqSlider(*apvts.getParameter(getBandParameterID(bandIndex, Band_Freq)), "Hz"),
+gainSlider(*apvts.getParameter(getBandParameterID(bandIndex, Band_Gain)), "dB"),
+qualitySlider(*apvts.getParameter(getBandParameterID(bandIndex, Band_Quality)), "dB/Oct"),
+enabledButton("Band " + juce::String(bandIndex + 1)),
+freqSliderAttachment(apvts, getBandParameterID(bandIndex, Band_Freq), freqSlider),
+gainSliderAttachment(apvts, getBandParameterID(bandIndex, Band_Gain), gainSlider),
+qualitySliderAttachment(apvts, getBandParameterID(bandIndex, Band_Quality), qualitySlider),
+enabledButtonAttachment(apvts, getBandParameterID(bandIndex, Band_Enabled), enabledButton)
+{
+    freqSlider.labels.add({0.f,"20Hz"});
+    freqSlider.labels.add({1.f,"20kHz"});
+    gainSlider.labels.add({0.f, "-24dB"});
+    gainSlider.labels.add({1.f,"24dB"});
+    qualitySlider.labels.add({0.f,"0.1"});
+    qualitySlider.labels.add({1.f, "10.0"});
+
+    // The attachment picks the selected item from the parameter, so the items have to exist first.
+    typeComboBox.addItemList(getBandTypeNames(), 1);
+    typeComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(apvts, getBandParameterID(bandIndex, Band_Type), typeComboBox);
+    channelComboBox.addItemList(getBandChannelNames(), 1);
+    channelComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(apvts, getBandParameterID(bandIndex, Band_Channel), channelComboBox);
+}
+
+void BandControls::setBounds(juce::Rectangle<int> bounds)
+{
+    enabledButton.setBounds(bounds.removeFromTop(24));
+    typeComboBox.setBounds(bounds.removeFromTop(24).reduced(4, 0));
+    channelComboBox.setBounds(bounds.removeFromTop(24).reduced(4, 0));
+    freqSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * .33));
+    gainSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * .5));
+    qualitySlider.setBounds(bounds);
+}
+
+std::vector<juce::Component*> BandControls::getComps()
+{
+    return
+    {
+        &enabledButton,
+        &typeComboBox,
+        &channelComboBox,
+        &freqSlider,
+        &gainSlider,
+        &qualitySlider
+    };
+}
 //==============================================================================
 FiveBandEQAudioProcessorEditor::FiveBandEQAudioProcessorEditor (FiveBandEQAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p),
-peak1FreqSlider(*audioProcessor.apvts.getParameter("Peak1 Freq"), "Hz"),
-peak2FreqSlider(*audioProcessor.apvts.getParameter("Peak2 Freq"), "Hz"),
-peak3FreqSlider(*audioProcessor.apvts.getParameter("Peak3 Freq"), "Hz"),
-peak1GainSlider(*audioProcessor.apvts.getParameter("Peak1 Gain"), "dB"),
-peak2GainSlider(*audioProcessor.apvts.getParameter("Peak2 Gain"), "dB"),
-peak3GainSlider(*audioProcessor.apvts.getParameter("Peak3 Gain"), "dB"),
-peak1QualitySlider(*audioProcessor.apvts.getParameter("Peak1 Quality"), "dB/Oct"),
-peak2QualitySlider(*audioProcessor.apvts.getParameter("Peak2 Quality"), "dB/Oct"),
-peak3QualitySlider(*audioProcessor.apvts.getParameter("Peak3 Quality"), "dB/Oct"),
 lowCutFreqSlider(*audioProcessor.apvts.getParameter("LowCut Freq"), "Hz"),
 highCutFreqSlider(*audioProcessor.apvts.getParameter("HighCut Freq"), "Hz"),
 lowCutSlopeSlider(*audioProcessor.apvts.getParameter("LowCut Slope"), "dB/Oct"),
 highCutSlopeSlider(*audioProcessor.apvts.getParameter("HighCut Slope"), "dB/Oct"),
 responseCurveComponent(audioProcessor),
-peak1FreqSliderAttachment(audioProcessor.apvts, "Peak1 Freq", peak1FreqSlider),
-peak1GainSliderAttachment(audioProcessor.apvts, "Peak1 Gain", peak1GainSlider),
-peak1QualitySliderAttachment(audioProcessor.apvts, "Peak1 Quality", peak1QualitySlider),
-peak2FreqSliderAttachment(audioProcessor.apvts, "Peak2 Freq", peak2FreqSlider),
-peak2GainSliderAttachment(audioProcessor.apvts, "Peak2 Gain", peak2GainSlider),
-peak2QualitySliderAttachment(audioProcessor.apvts, "Peak2 Quality", peak2QualitySlider),
-peak3FreqSliderAttachment(audioProcessor.apvts, "Peak3 Freq", peak3FreqSlider),
-peak3GainSliderAttachment(audioProcessor.apvts, "Peak3 Gain", peak3GainSlider),
-peak3QualitySliderAttachment(audioProcessor.apvts, "Peak3 Quality", peak3QualitySlider),
+loudnessDisplay(audioProcessor),
 lowCutFreqSliderAttachment(audioProcessor.apvts, "LowCut Freq", lowCutFreqSlider),
 highCutFreqSliderAttachment(audioProcessor.apvts, "HighCut Freq", highCutFreqSlider),
 lowCutSlopeSliderAttachment(audioProcessor.apvts, "LowCut Slope", lowCutSlopeSlider),
-highCutSlopeSliderAttachment(audioProcessor.apvts, "HighCut Slope", highCutSlopeSlider)
+highCutSlopeSliderAttachment(audioProcessor.apvts, "HighCut Slope", highCutSlopeSlider),
+autoGainButtonAttachment(audioProcessor.apvts, "Auto Gain", autoGainButton)
 {
+    FIVEBANDEQ_TRACE_SCOPE("Editor constructor");
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    peak1FreqSlider.labels.add({0.f,"20Hz"});
-    peak1FreqSlider.labels.add({1.f,"20kHz"});
-    peak1GainSlider.labels.add({0.f, "-24dB"});
-    peak1GainSlider.labels.add({1.f,"24dB"});
-    peak1QualitySlider.labels.add({0.f,"0.1"});
-    peak1QualitySlider.labels.add({1.f, "10.0"});
-    peak2FreqSlider.labels.add({0.f,"20Hz"});
-    peak2FreqSlider.labels.add({1.f,"20kHz"});
-    peak2GainSlider.labels.add({0.f, "-24dB"});
-    peak2GainSlider.labels.add({1.f,"24dB"});
-    peak2QualitySlider.labels.add({0.f,"0.1"});
-    peak2QualitySlider.labels.add({1.f, "10.0"});
-    peak3FreqSlider.labels.add({0.f,"20Hz"});
-    peak3FreqSlider.labels.add({1.f,"20kHz"});
-    peak3GainSlider.labels.add({0.f, "-24dB"});
-    peak3GainSlider.labels.add({1.f,"24dB"});
-    peak3QualitySlider.labels.add({0.f,"0.1"});
-    peak3QualitySlider.labels.add({1.f, "10.0"});
     lowCutFreqSlider.labels.add({0.f,"20Hz"});
     lowCutFreqSlider.labels.add({1.f,"20kHz"});
     highCutFreqSlider.labels.add({0.f,"20Hz"});
     highCutFreqSlider.labels.add({1.f,"20kHz"});
     lowCutSlopeSlider.labels.add({0.0f, "12"});
-    lowCutSlopeSlider.labels.add({1.f, "48"});   
+    lowCutSlopeSlider.labels.add({1.f, "96"});   
     highCutSlopeSlider.labels.add({0.0f, "12"});
-    highCutSlopeSlider.labels.add({1.f, "48"}); 
+    highCutSlopeSlider.labels.add({1.f, "96"}); 
+
+    for(int page = 0; page < numBandPages; ++page)
+    {
+        juce::String str;
+        str << "Bands " << (page * bandsPerPage + 1) << "-" << ((page + 1) * bandsPerPage);
+        bandPageSelector.addItem(str, page + 1);
+    }
+    bandPageSelector.onChange = [this] { showBandPage(bandPageSelector.getSelectedItemIndex()); };
+
+    stereoModeComboBox.addItemList(getStereoModeNames(), 1);
+    stereoModeComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(audioProcessor.apvts, "Stereo Mode", stereoModeComboBox);
+    designComboBox.addItemList(getDesignMethodNames(), 1);
+    designComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(audioProcessor.apvts, "Filter Design", designComboBox);
+    lowCutChannelComboBox.addItemList(getBandChannelNames(), 1);
+    lowCutChannelComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(audioProcessor.apvts, "LowCut Channel", lowCutChannelComboBox);
+    highCutChannelComboBox.addItemList(getBandChannelNames(), 1);
+    highCutChannelComboBoxAttachment = std::make_unique<APVTS::ComboBoxAttachment>(audioProcessor.apvts, "HighCut Channel", highCutChannelComboBox);
+
+    setupMatchButtons();
+
+   #if FIVEBANDEQ_ENABLE_TRACING
+    saveTraceButton.onClick = []
+    {
+        auto file = juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
+                        .getNonexistentChildFile("FiveBandEQ trace", ".json");
+        TraceProfiler::getInstance().writeToFile(file);
+    };
+    addAndMakeVisible(saveTraceButton);
+   #endif
 
     for( auto* comp : getComps () )
     {
         addAndMakeVisible(comp);
     }
-    
+
+    // Size first, so the page is laid out once rather than at zero size and then again.
     setSize (1000, 800);
+    
+    bandPageSelector.setSelectedItemIndex(0, juce::dontSendNotification);
+    showBandPage(0);
 }
 
 FiveBandEQAudioProcessorEditor::~FiveBandEQAudioProcessorEditor()
@@ -451,8 +605,68 @@ FiveBandEQAudioProcessorEditor::~FiveBandEQAudioProcessorEditor()
     
 }
 
+size_t FiveBandEQAudioProcessorEditor::getMemoryFootprint() const
+{
+    auto numBytes = sizeof(*this) + responseCurveComponent.getBackgroundBytes();
+    for(const auto& controls : bandControls)
+        if(controls != nullptr)
+            numBytes += sizeof(BandControls);
+    return numBytes;
+}
+
 //==============================================================================
 
+void FiveBandEQAudioProcessorEditor::showBandPage(int page)
+{
+    FIVEBANDEQ_TRACE_SCOPE("Band page");
+    for(int i = 0; i < bandsPerPage; ++i)
+    {
+        bandControls[i] = std::make_unique<BandControls>(audioProcessor.apvts, page * bandsPerPage + i);
+
+        for(auto* comp : bandControls[i]->getComps())
+            addAndMakeVisible(comp);
+    }
+
+    resized();
+}
+
+void FiveBandEQAudioProcessorEditor::setupMatchButtons()
+{
+    auto& matchEQ = audioProcessor.getMatchEQ();
+
+    // Only one spectrum is captured at a time; pressing a capture button restarts that capture.
+    auto setupCaptureButton = [&matchEQ](juce::TextButton& button, juce::TextButton& other, MatchEQ::Target target)
+    {
+        button.setClickingTogglesState(true);
+        button.onClick = [&button, &other, &matchEQ, target]
+        {
+            if(button.getToggleState())
+            {
+                other.setToggleState(false, juce::dontSendNotification);
+                matchEQ.clear(target);
+                matchEQ.startCapture(target);
+            }
+            else
+            {
+                matchEQ.stopCapture();
+            }
+        };
+    };
+
+    setupCaptureButton(captureReferenceButton, captureInputButton, MatchEQ::Reference);
+    setupCaptureButton(captureInputButton, captureReferenceButton, MatchEQ::Input);
+
+    matchButton.onClick = [this, &matchEQ]
+    {
+        matchEQ.stopCapture();
+        captureReferenceButton.setToggleState(false, juce::dontSendNotification);
+        captureInputButton.setToggleState(false, juce::dontSendNotification);
+
+        FIVEBANDEQ_TRACE_SCOPE("Match EQ fit");
+        if(matchEQ.canFit())
+            setChainSettings(audioProcessor.apvts, matchEQ.fit(getChainSettings(audioProcessor.apvts)));
+    };
+}
 
 
 
@@ -463,35 +677,38 @@ void FiveBandEQAudioProcessorEditor::resized()
 
     auto bounds = getLocalBounds();
     auto responseArea = bounds.removeFromTop(bounds.getHeight() * .33);
+    loudnessDisplay.setBounds(responseArea.removeFromBottom(20));
     responseCurveComponent.setBounds(responseArea);
     auto lowCutArea = bounds.removeFromLeft(bounds.getWidth()*.20);
     auto highCutArea = bounds.removeFromRight(bounds.getWidth() * .25);
 
+    lowCutChannelComboBox.setBounds(lowCutArea.removeFromBottom(24).reduced(4, 0));
+    highCutChannelComboBox.setBounds(highCutArea.removeFromBottom(24).reduced(4, 0));
     lowCutFreqSlider.setBounds(lowCutArea.removeFromTop(lowCutArea.getHeight()*.5));
     lowCutSlopeSlider.setBounds(lowCutArea);
     highCutFreqSlider.setBounds(highCutArea.removeFromTop(highCutArea.getHeight()*.5));
     highCutSlopeSlider.setBounds(highCutArea);
 
     auto peakArea = bounds;
-
-    auto peak1Area = peakArea.removeFromLeft(peakArea.getWidth()*.33);
-    auto peak3Area= peakArea.removeFromRight(peakArea.getWidth()*.5);
-
-    peak2FreqSlider.setBounds(peakArea.removeFromTop(peakArea.getHeight() * .33));
-    peak2GainSlider.setBounds(peakArea.removeFromTop(peakArea.getHeight() * .33));
-    peak2QualitySlider.setBounds(peakArea);
-
-
-    peak1FreqSlider.setBounds(peak1Area.removeFromTop(peak1Area.getHeight() * .33));
-    peak1GainSlider.setBounds(peak1Area.removeFromTop(peak1Area.getHeight() * .33));
-    peak1QualitySlider.setBounds(peak1Area);
-
-    
-    peak3FreqSlider.setBounds(peak3Area.removeFromTop(peak3Area.getHeight() * .33));
-    peak3GainSlider.setBounds(peak3Area.removeFromTop(peak3Area.getHeight() * .33));
-    peak3QualitySlider.setBounds(peak3Area);
-
-
+    auto controlStrip = peakArea.removeFromTop(24);
+    bandPageSelector.setBounds(controlStrip.removeFromLeft(controlStrip.getWidth() / 3).reduced(4, 0));
+    stereoModeComboBox.setBounds(controlStrip.removeFromLeft(controlStrip.getWidth() / 5).reduced(4, 0));
+    designComboBox.setBounds(controlStrip.removeFromLeft(controlStrip.getWidth() / 4).reduced(4, 0));
+    autoGainButton.setBounds(controlStrip.removeFromLeft(controlStrip.getWidth() / 4).reduced(2, 0));
+   #if FIVEBANDEQ_ENABLE_TRACING
+    saveTraceButton.setBounds(controlStrip.removeFromRight(controlStrip.getWidth() / 4).reduced(2, 0));
+   #endif
+    auto buttonWidth = controlStrip.getWidth() / 3;
+    captureReferenceButton.setBounds(controlStrip.removeFromLeft(buttonWidth).reduced(2, 0));
+    captureInputButton.setBounds(controlStrip.removeFromLeft(buttonWidth).reduced(2, 0));
+    matchButton.setBounds(controlStrip.reduced(2, 0));
+
+    auto columnWidth = peakArea.getWidth() / bandsPerPage;
+    for(auto& controls : bandControls)
+    {
+        if(controls != nullptr)
+            controls->setBounds(peakArea.removeFromLeft(columnWidth));
+    }
 }
 
 
@@ -507,19 +724,20 @@ std::vector<juce::Component*> FiveBandEQAudioProcessorEditor::getComps()
 {
     return
     {
-        &peak1FreqSlider,
-        &peak2FreqSlider,
-        &peak3FreqSlider,
-        &peak1GainSlider,
-        &peak2GainSlider,
-        &peak3GainSlider,
-        &peak1QualitySlider,
-        &peak2QualitySlider,
-        &peak3QualitySlider,
         &lowCutFreqSlider,
         &highCutFreqSlider,
         &lowCutSlopeSlider,
         &highCutSlopeSlider,
-        &responseCurveComponent
+        &lowCutChannelComboBox,
+        &highCutChannelComboBox,
+        &bandPageSelector,
+        &stereoModeComboBox,
+        &designComboBox,
+        &captureReferenceButton,
+        &captureInputButton,
+        &matchButton,
+        &autoGainButton,
+        &responseCurveComponent,
+        &loudnessDisplay
     };
-}
+}
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "TraceProfiler.h"
 
 //==============================================================================
 /**
@@ -22,7 +23,7 @@ struct LookAndFeel : juce::LookAndFeel_V4
 };
 struct RotarySliderWithLabels : juce::Slider{
   RotarySliderWithLabels(juce::RangedAudioParameter& rap, const juce::String& unitSuffix) : param(&rap), suffix(unitSuffix), juce::Slider(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag, juce::Slider::TextEntryBoxPosition::NoTextBox){
-    setLookAndFeel(&lnf);
+    setLookAndFeel(lnf);
   }
   ~RotarySliderWithLabels(){
     setLookAndFeel(nullptr);
@@ -37,11 +38,23 @@ struct RotarySliderWithLabels : juce::Slider{
   int getTextHeight() const {return 14; }
   juce::String getDisplayString() const;
 private:
-  LookAndFeel lnf;
+  // One for every slider of every open editor, rather than one each.
+  juce::SharedResourcePointer<LookAndFeel> lnf;
   juce::RangedAudioParameter* param;
   juce::String suffix;
 };
 
+// The response curve's grid and labels only depend on its size, so every open editor of the
+// same size can draw the same image. An image goes once no editor holds it. Message thread.
+struct ResponseCurveBackgrounds
+{
+  // The image of that size some editor holds, or a null image.
+  juce::Image find(int width, int height);
+  void add(const juce::Image& image);
+private:
+  std::vector<juce::Image> images;
+};
+
 struct ResponseCurveComponent: public juce::Component,
 juce::AudioProcessorParameter::Listener, juce::Timer
 {
@@ -52,15 +65,66 @@ juce::AudioProcessorParameter::Listener, juce::Timer
   void timerCallback() override;
   void paint(juce::Graphics& g) override;
   void resized() override;
+  // Its share of the background image, in bytes.
+  size_t getBackgroundBytes() const;
 private:
   FiveBandEQAudioProcessor& audioProcessor;
   juce::Atomic<bool> parametersChanged {false};
-  MonoChain monoChain;
+  // Drawn from what the processor publishes. Hosts that stop calling processBlock while the
+  // transport is stopped publish nothing, so once the processor hasn't processed for
+  // idleTicks a change to the design's parameters is designed here instead, into
+  // localDesign, which is shown until the processor publishes again.
+  CoefficientSnapshot snapshot, localDesign;
+  juce::uint32 snapshotVersion = 0;
+  bool showingLocalDesign = false;
+  juce::uint32 lastNumProcessedBlocks = 0;
+  int ticksSinceProcessed = 0;
+  static constexpr int idleTicks = 15;
+  // Rendered on the first paint after a resize, so editors that are never shown never build it,
+  // and shared with the other editors of the same size. An editor that isn't showing lets go
+  // of it once it hasn't painted for hiddenTicks, four seconds of the 60 Hz timer.
   juce::Image background;
+  juce::SharedResourcePointer<ResponseCurveBackgrounds> backgrounds;
+  int ticksSincePaint = 0;
+  static constexpr int hiddenTicks = 240;
+  void renderBackground();
   juce::Rectangle<int> getRenderArea();
   juce::Rectangle<int> getAnalysisArea();
 };
 
+// Input and output loudness and the auto gain, refreshed as often as the meters step. A
+// click restarts both integrated readings.
+struct LoudnessDisplay : public juce::Component, juce::Timer
+{
+  LoudnessDisplay(FiveBandEQAudioProcessor&);
+  void paint(juce::Graphics& g) override;
+  void timerCallback() override;
+  void mouseDown(const juce::MouseEvent&) override;
+private:
+  FiveBandEQAudioProcessor& audioProcessor;
+  LoudnessSnapshot readings;
+};
+
+// Freq, gain and quality knobs plus the on/off switch, shape and channel selectors for one band. The editor only keeps
+// the bands of the page that is currently shown, so these are built per page.
+struct BandControls
+{
+  BandControls(juce::AudioProcessorValueTreeState& apvts, int bandIndex);
+  void setBounds(juce::Rectangle<int> bounds);
+  std::vector<juce::Component*> getComps();
+
+  RotarySliderWithLabels freqSlider, gainSlider, qualitySlider;
+  juce::ToggleButton enabledButton;
+  juce::ComboBox typeComboBox, channelComboBox;
+
+  using APVTS = juce::AudioProcessorValueTreeState;
+  APVTS::SliderAttachment freqSliderAttachment,
+                          gainSliderAttachment,
+                          qualitySliderAttachment;
+  APVTS::ButtonAttachment enabledButtonAttachment;
+  std::unique_ptr<APVTS::ComboBoxAttachment> typeComboBoxAttachment, channelComboBoxAttachment;
+};
+
 class FiveBandEQAudioProcessorEditor  : public juce::AudioProcessorEditor
 {
 public:
@@ -70,44 +134,51 @@ public:
     //==============================================================================
     void resized() override;
     
+    // The editor, the shown page's band controls and the response curve's share of its
+    // background, in bytes. The shared LookAndFeel isn't counted.
+    size_t getMemoryFootprint() const;
+    
 private:
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     FiveBandEQAudioProcessor& audioProcessor;
 
-    
+    static constexpr int bandsPerPage = 3;
+    static constexpr int numBandPages = maxBands / bandsPerPage;
 
-    RotarySliderWithLabels peak1FreqSlider,
-    peak2FreqSlider,
-    peak3FreqSlider,
-    peak1GainSlider,
-    peak2GainSlider,
-    peak3GainSlider,
-    peak1QualitySlider,
-    peak2QualitySlider,
-    peak3QualitySlider,
-    lowCutFreqSlider,
+    RotarySliderWithLabels lowCutFreqSlider,
     highCutFreqSlider,
     lowCutSlopeSlider,
     highCutSlopeSlider;
 
     ResponseCurveComponent responseCurveComponent;
+    LoudnessDisplay loudnessDisplay;
+
+    juce::ComboBox bandPageSelector, stereoModeComboBox, designComboBox,
+                   lowCutChannelComboBox, highCutChannelComboBox;
+    juce::TextButton captureReferenceButton { "Capture Ref" },
+                     captureInputButton { "Capture Input" },
+                     matchButton { "Match" };
+    juce::ToggleButton autoGainButton { "Auto Gain" };
+   #if FIVEBANDEQ_ENABLE_TRACING
+    juce::TextButton saveTraceButton { "Save Trace" };   // writes the trace to the desktop
+   #endif
+    std::array<std::unique_ptr<BandControls>, bandsPerPage> bandControls;
 
     using APVTS = juce::AudioProcessorValueTreeState;
     using Attachment = APVTS::SliderAttachment;
-    Attachment peak1FreqSliderAttachment,
-               peak2FreqSliderAttachment,
-               peak3FreqSliderAttachment,
-               peak1GainSliderAttachment,
-               peak2GainSliderAttachment,
-               peak3GainSliderAttachment,
-               peak1QualitySliderAttachment,
-               peak2QualitySliderAttachment,
-               peak3QualitySliderAttachment,
-               lowCutFreqSliderAttachment,
+    Attachment lowCutFreqSliderAttachment,
                highCutFreqSliderAttachment,
                lowCutSlopeSliderAttachment,
                highCutSlopeSliderAttachment;
+    APVTS::ButtonAttachment autoGainButtonAttachment;
+    std::unique_ptr<APVTS::ComboBoxAttachment> stereoModeComboBoxAttachment,
+                                               designComboBoxAttachment,
+                                               lowCutChannelComboBoxAttachment,
+                                               highCutChannelComboBoxAttachment;
+
+    void showBandPage(int page);
+    void setupMatchButtons();
 
     std::vector<juce::Component*> getComps();
 
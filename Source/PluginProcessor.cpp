@@ -8,6 +8,11 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "MatchEQ.h"
+#include "DoubleCascade.h"
+#include "ParallelCascade.h"
+#include "KernelDispatch.h"
+#include "TraceProfiler.h"
 
 //==============================================================================
 FiveBandEQAudioProcessor::FiveBandEQAudioProcessor()
@@ -21,7 +26,17 @@ FiveBandEQAudioProcessor::FiveBandEQAudioProcessor()
                      #endif
                        )
 #endif
+, matchEQ(std::make_unique<MatchEQ>()), doubleCascade(std::make_unique<DoubleCascade>()),
+  parallelCascade(std::make_unique<ParallelCascade>()),
+  parallelDesigner(std::make_unique<ParallelFormDesigner>(*this))
 {
+    // The first event also allocates the trace buffers, so let it happen here rather than on the audio thread.
+    FIVEBANDEQ_TRACE_SCOPE("Processor constructor");
+    // Likewise the kernel table, whose first use asks the CPU what it supports.
+    getKernels();
+    autoGainParameter = apvts.getRawParameterValue("Auto Gain");
+    renderQualityParameter = apvts.getRawParameterValue("Render Quality");
+    cascadeFormParameter = apvts.getRawParameterValue("Cascade Form");
 }
 
 FiveBandEQAudioProcessor::~FiveBandEQAudioProcessor()
@@ -93,22 +108,43 @@ void FiveBandEQAudioProcessor::changeProgramName (int index, const juce::String&
 //==============================================================================
 void FiveBandEQAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
+    FIVEBANDEQ_TRACE_SCOPE("prepareToPlay");
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
     
-    juce::dsp::ProcessSpec spec; //
+    // Every channel of the bus gets its own states; wide buses split their pairs across a
+    // few workers, leaving one core for the host's own audio thread.
+    auto numChannels = juce::jmax(getTotalNumInputChannels(), getTotalNumOutputChannels());
+    const auto inputLayout = getChannelLayoutOfBus(true, 0);
+    const auto outputLayout = getChannelLayoutOfBus(false, 0);
     
-    spec.maximumBlockSize = samplesPerBlock; // number of samples to be processed at one time
+    arena.reset(StereoCascade::getArenaSize(numChannels, samplesPerBlock)
+                + DoubleCascade::getArenaSize(numChannels)
+                + ParallelCascade::getArenaSize(numChannels)
+                + LoudnessMeter::getArenaSize(inputLayout.size())
+                + LoudnessMeter::getArenaSize(outputLayout.size()));
     
-    spec.numChannels = 1; // mono channels can only handle one chain at a time
+    cascade.prepare(numChannels, samplesPerBlock, arena);
+    doubleCascade->prepare(numChannels, arena);
+    parallelCascade->prepare(numChannels, arena);
+    workerPool.setAudioTiming(sampleRate, samplesPerBlock);
+    workerPool.setNumWorkers(juce::jlimit(0, maxWorkers, juce::jmin(cascade.getNumPairs(), juce::SystemStats::getNumCpus()) - 1));
     
-    spec.sampleRate = sampleRate;
+    // The designer sleeps until processBlock asks it for a form, so it runs with playback
+    // rather than with "Cascade Form", which can change where no thread may be started.
+    parallelDesigner->start();
     
-    leftChain.prepare(spec);
+    // The design itself waits for the first processBlock: hosts recalling a session usually
+    // call setStateInformation after this, and designing here would then be thrown away.
+    designedSettingsValid = false;
     
-    rightChain.prepare(spec);
+    matchEQ->prepare(sampleRate);
     
-    updateFilters();
+    inputMeter.prepare(sampleRate, inputLayout, arena);
+    outputMeter.prepare(sampleRate, outputLayout, arena);
+    jassert(arena.getUsed() == arena.getSize());
+    autoGain.reset(sampleRate, autoGainRampSeconds);
+    autoGain.setCurrentAndTargetValue(juce::Decibels::decibelsToGain(autoGainDecibels.load()));
 
 
 }
@@ -117,6 +153,16 @@ void FiveBandEQAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    workerPool.setNumWorkers(0);
+    parallelDesigner->stop();
+}
+
+void FiveBandEQAudioProcessor::audioWorkgroupContextChanged (const juce::AudioWorkgroup& workgroup)
+{
+    // The workers join the host's workgroup, so they are scheduled with its audio thread.
+    // Some hosts call this on the audio thread itself, so it only hands the workgroup over;
+    // the workers switch to it the next time they wake.
+    workerPool.setWorkgroup(workgroup);
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -126,12 +172,10 @@ bool FiveBandEQAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
     juce::ignoreUnused (layouts);
     return true;
   #else
-    // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // Any layout works, from mono up to high order ambisonics: every channel gets its own
+    // states and the stereo modes only apply to stereo buses.
+    if (layouts.getMainOutputChannelSet().isDisabled()
+     || layouts.getMainOutputChannelSet().size() > maxChannels)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -147,7 +191,9 @@ bool FiveBandEQAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
 
 void FiveBandEQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    FIVEBANDEQ_TRACE_SCOPE("processBlock");
     juce::ScopedNoDenormals noDenormals;
+    numProcessedBlocks.fetch_add(1, std::memory_order_relaxed);
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -160,7 +206,14 @@ void FiveBandEQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
     
+    matchEQ->pushSamples(buffer);
+    inputMeter.process(buffer.getArrayOfReadPointers(), buffer.getNumChannels(), buffer.getNumSamples());
+    
+    updateRenderQuality();
     updateFilters();
+    
+    if(activeQuality == Render_Live)
+        updateCascadeForm();
 
     // This is the place where you'd normally do the guts of your plugin's
     // audio processing...
@@ -168,20 +221,202 @@ void FiveBandEQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
     // the samples and the outer loop is handling the channels.
     // Alternatively, you can process the samples with the channels
     // interleaved by keeping the same state.
-    juce::dsp::AudioBlock<float> block(buffer);
+    const int numChannels = juce::jmin(buffer.getNumChannels(), cascade.getNumPairs() * 2);
+    const int numPairs = (numChannels + 1) / 2;
+    const int numSamples = buffer.getNumSamples();
+    
+    // Fetch the pointers here: AudioBuffer isn't safe to touch from the workers.
+    auto* const* channels = buffer.getArrayOfWritePointers();
+    
+    if(activeQuality != Render_Live)
+    {
+        FIVEBANDEQ_TRACE_SCOPE("Double cascade");
+        doubleCascade->process(channels, numChannels, numSamples);
+    }
+    else
+    {
+        const bool parallel = parallelCascade->isRunning();
+        if(! parallel)
+            cascade.prepareBlock(numSamples);
+        
+        auto processPair = [&](int pair)
+        {
+            FIVEBANDEQ_TRACE_SCOPE("Cascade pair");
+            auto* left = channels[2 * pair];
+            auto* right = 2 * pair + 1 < numChannels ? channels[2 * pair + 1] : nullptr;
+            
+            if(parallel)
+                parallelCascade->process(pair, left, right, numSamples);
+            else
+                cascade.process(pair, left, right, numSamples);
+        };
+        
+        if(numSamples * cascade.getNumSections() >= minWorkPerPairForWorkers)
+        {
+            workerPool.run(numPairs, processPair);
+        }
+        else
+        {
+            for(int pair = 0; pair < numPairs; ++pair)
+                processPair(pair);
+        }
+    }
+    
+    // Both meters have seen the same samples, so they complete their steps together.
+    if(outputMeter.process(channels, buffer.getNumChannels(), numSamples))
+        updateAutoGain();
+    
+    applyAutoGain(channels, buffer.getNumChannels(), numSamples);
+}
+
+void FiveBandEQAudioProcessor::updateRenderQuality() noexcept
+{
+    auto quality = isNonRealtime() ? static_cast<RenderQuality>(renderQualityParameter->load()) : Render_Live;
+    if(quality == activeQuality)
+        return;
+    
+    // The engines don't share states and the one taking over has been idle, so both start
+    // from silence (hosts start a render from a stopped transport anyway). A full redesign
+    // gives the new engine its layout, and the matched designs if it asks for them.
+    activeQuality = quality;
+    parallelCascade->stop();
+    cascade.reset();
+    doubleCascade->reset();
+    designedSettingsValid = false;
+}
+
+void FiveBandEQAudioProcessor::updateCascadeForm() noexcept
+{
+    const bool wanted = cascadeFormParameter->load() > 0.5f;
+    
+    if(parallelCascade->isRunning())
+    {
+        if(! wanted)
+            parallelCascade->handBack(cascade);
+        return;
+    }
+    
+    if(! wanted)
+        return;
+    
+    // The designer may still be on an older layout, or the layout may not have a form
+    // accurate enough; series keeps running either way and this tries again next block.
+    // A layout published while the parallel form wasn't wanted is asked for here.
+    const auto& form = parallelDesigner->getLatest();
+    if(form.layoutVersion != layoutVersion)
+        parallelDesigner->requestDesign();
+    else if(form.valid)
+        parallelCascade->takeOver(form, cascade);
+}
+
+void FiveBandEQAudioProcessor::updateAutoGain() noexcept
+{
+    auto decibels = 0.f;
+    
+    if(autoGainParameter->load() > 0.5f)
+    {
+        // Hold the last gain through silence, and until both short-term readings exist.
+        auto input = inputMeter.getReadings().shortTerm;
+        auto output = outputMeter.getReadings().shortTerm;
+        
+        decibels = input > LoudnessMeter::silence && output > LoudnessMeter::silence
+                 ? juce::jlimit(-maxAutoGainDecibels, maxAutoGainDecibels, input - output)
+                 : autoGainDecibels.load(std::memory_order_relaxed);
+    }
+    
+    autoGainDecibels.store(decibels, std::memory_order_relaxed);
+    autoGain.setTargetValue(juce::Decibels::decibelsToGain(decibels));
+}
+
+void FiveBandEQAudioProcessor::applyAutoGain(float* const* channels, int numChannels, int numSamples) noexcept
+{
+    if(! autoGain.isSmoothing())
+    {
+        auto gain = autoGain.getCurrentValue();
+        if(gain != 1.f)
+            for(int ch = 0; ch < numChannels; ++ch)
+                juce::FloatVectorOperations::multiply(channels[ch], gain, numSamples);
+        return;
+    }
     
-    auto leftBlock = block.getSingleChannelBlock(0);
-    auto rightBlock = block.getSingleChannelBlock(1);
+    for(int i = 0; i < numSamples; ++i)
+    {
+        auto gain = autoGain.getNextValue();
+        for(int ch = 0; ch < numChannels; ++ch)
+            channels[ch][i] *= gain;
+    }
+}
+
+LoudnessSnapshot FiveBandEQAudioProcessor::getLoudnessSnapshot() const noexcept
+{
+    return { inputMeter.getReadings(), outputMeter.getReadings(), autoGainDecibels.load(std::memory_order_relaxed) };
+}
+
+void FiveBandEQAudioProcessor::resetIntegratedLoudness() noexcept
+{
+    inputMeter.resetIntegrated();
+    outputMeter.resetIntegrated();
+}
+
+MemoryFootprint FiveBandEQAudioProcessor::getMemoryFootprint() const
+{
+    MemoryFootprint footprint;
+    footprint.processor = sizeof(*this) + sizeof(MatchEQ) + sizeof(DoubleCascade)
+                        + sizeof(ParallelCascade) + sizeof(ParallelFormDesigner);
+    footprint.arena = arena.getAllocatedBytes();
+    footprint.parallelForms = parallelDesigner->getAllocatedBytes();
+    footprint.matchEQ = matchEQ->getAllocatedBytes();
+    
+    if(auto* editor = dynamic_cast<FiveBandEQAudioProcessorEditor*>(getActiveEditor()))
+        footprint.editor = editor->getMemoryFootprint();
+    
+    return footprint;
+}
+
+void FiveBandEQAudioProcessor::processBlockBypassed (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    numProcessedBlocks.fetch_add(1, std::memory_order_relaxed);
+    if(! publishedBypassed)
+        publishCoefficients(true);
+    
+    AudioProcessor::processBlockBypassed(buffer, midiMessages);
+}
+
+void FiveBandEQAudioProcessor::publishCoefficients(bool bypassed) noexcept
+{
+    const bool newLayout = publishedSnapshot.layoutVersion != layoutVersion;
+    auto version = publishedVersion.load(std::memory_order_relaxed);
+    publishedVersion.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    publishedSnapshot.coefficients = chainCoefficients;
+    publishedSnapshot.sampleRate = getSampleRate();
+    publishedSnapshot.bypassed = bypassed;
+    publishedSnapshot.layoutVersion = layoutVersion;
+    publishedBypassed = bypassed;
     
-    juce::dsp::ProcessContextReplacing<float> leftContext(leftBlock);
-    juce::dsp::ProcessContextReplacing<float> rightContext(rightBlock);
+    publishedVersion.store(version + 2, std::memory_order_release);
     
-    leftChain.process(leftContext);
-    rightChain.process(rightContext);
+    // Only this thread writes the snapshot, so it can read its own layoutVersion above.
+    if(newLayout && cascadeFormParameter->load() > 0.5f)
+        parallelDesigner->requestDesign();
+}
 
+bool FiveBandEQAudioProcessor::readCoefficientSnapshot(CoefficientSnapshot& snapshot, juce::uint32& version) const noexcept
+{
+    auto before = publishedVersion.load(std::memory_order_acquire);
+    if(before == version || (before & 1) != 0)
+        return false;
     
+    auto copy = publishedSnapshot;
+    std::atomic_thread_fence(std::memory_order_acquire);
     
-    // need to extract left and right channel from buffer
+    if(publishedVersion.load(std::memory_order_relaxed) != before)
+        return false;
+    
+    snapshot = copy;
+    version = before;
+    return true;
 }
 
 //==============================================================================
@@ -199,6 +434,7 @@ juce::AudioProcessorEditor* FiveBandEQAudioProcessor::createEditor()
 //==============================================================================
 void FiveBandEQAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
+    FIVEBANDEQ_TRACE_SCOPE("getStateInformation");
     // You should use this method to store your parameters in the memory block.
     // You could do that either as raw data, or use the XML or ValueTree classes
     // as intermediaries to make it easy to save and load complex data.
@@ -208,120 +444,877 @@ void FiveBandEQAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 
 void FiveBandEQAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
+    FIVEBANDEQ_TRACE_SCOPE("setStateInformation");
     // You should use this method to restore your parameters from this memory block,
     // whose contents will have been created by the getStateInformation() call.
     auto tree = juce::ValueTree::readFromData(data, sizeInBytes);
     if(tree.isValid() ){
+        // Hosts may call this while processBlock is running, so leave the redesign to the
+        // next processBlock (or prepareToPlay) rather than touching the chains from here.
         apvts.replaceState(tree);
-        updateFilters();
     }
 }
 
-ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts)
+const juce::StringArray& getStereoModeNames()
+{
+    static const juce::StringArray names { "Linked", "Dual Mono", "Mid/Side" };
+    return names;
+}
+
+const juce::StringArray& getBandChannelNames()
+{
+    static const juce::StringArray names { "Both", "Left / Mid", "Right / Side" };
+    return names;
+}
+
+const juce::StringArray& getSlopeNames()
+{
+    static const auto names = []
+    {
+        juce::StringArray array;
+        for(int i = 0; i < maxCutSections; i++)
+        {
+            juce::String str;
+            str << (12 + i*12);
+            str << " db/Oct";
+            array.add(str);
+        }
+        return array;
+    }();
+    
+    return names;
+}
+
+const juce::StringArray& getRenderQualityNames()
+{
+    static const juce::StringArray names { "Same as Live", "Double Precision", "Double + Matched" };
+    return names;
+}
+
+const juce::StringArray& getCascadeFormNames()
+{
+    static const juce::StringArray names { "Series", "Parallel" };
+    return names;
+}
+
+const juce::String& getBandParameterID(int bandIndex, BandParameter parameter)
+{
+    static const auto ids = []
+    {
+        const char* names[NumBandParameters] { "Freq", "Gain", "Quality", "Enabled", "Type", "Channel" };
+        
+        std::array<std::array<juce::String, NumBandParameters>, maxBands> table;
+        for(int band = 0; band < maxBands; ++band)
+        {
+            for(int p = 0; p < NumBandParameters; ++p)
+            {
+                juce::String str;
+                str << "Peak" << (band + 1) << " " << names[p];
+                table[band][p] = str;
+            }
+        }
+        return table;
+    }();
+    
+    return ids[bandIndex][parameter];
+}
+
+// getValue(parameterID) returns the parameter's plain (not normalised) value.
+template<typename GetValue>
+static ChainSettings readChainSettings(GetValue&& getValue)
 {
     ChainSettings settings;
     
-    settings.lowCutFreq = apvts.getRawParameterValue("LowCut Freq")->load();
-    settings.highCutFreq = apvts.getRawParameterValue("HighCut Freq")->load();
+    settings.lowCutFreq = getValue("LowCut Freq");
+    settings.highCutFreq = getValue("HighCut Freq");
+    
+    for(int i = 0; i < maxBands; ++i)
+    {
+        auto& band = settings.bands[i];
+        band.freq = getValue(getBandParameterID(i, Band_Freq));
+        band.gainInDecibels = getValue(getBandParameterID(i, Band_Gain));
+        band.quality = getValue(getBandParameterID(i, Band_Quality));
+        band.enabled = getValue(getBandParameterID(i, Band_Enabled)) > 0.5f;
+        band.type = static_cast<BandType>(getValue(getBandParameterID(i, Band_Type)));
+        band.channel = static_cast<BandChannel>(getValue(getBandParameterID(i, Band_Channel)));
+    }
     
-    settings.peak1Freq = apvts.getRawParameterValue("Peak1 Freq")->load();
-    settings.peak1GainInDecibels = apvts.getRawParameterValue("Peak1 Gain")->load();
-    settings.peak1Quality = apvts.getRawParameterValue("Peak1 Quality")->load();
+    settings.lowCutSlope = static_cast<Slope>(getValue("LowCut Slope"));
+    settings.highCutSlope = static_cast<Slope>(getValue("HighCut Slope"));
+    settings.lowCutChannel = static_cast<BandChannel>(getValue("LowCut Channel"));
+    settings.highCutChannel = static_cast<BandChannel>(getValue("HighCut Channel"));
     
-    settings.peak2Freq = apvts.getRawParameterValue("Peak2 Freq")->load();
-    settings.peak2GainInDecibels = apvts.getRawParameterValue("Peak2 Gain")->load();
-    settings.peak2Quality = apvts.getRawParameterValue("Peak2 Quality")->load();
+    settings.stereoMode = static_cast<StereoMode>(getValue("Stereo Mode"));
+    settings.design = static_cast<DesignMethod>(getValue("Filter Design"));
     
-    settings.peak3Freq = apvts.getRawParameterValue("Peak3 Freq")->load();
-    settings.peak3GainInDecibels = apvts.getRawParameterValue("Peak3 Gain")->load();
-    settings.peak3Quality = apvts.getRawParameterValue("Peak3 Quality")->load();
+    return settings;
+}
+
+ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts)
+{
+    return readChainSettings([&apvts](juce::StringRef parameterID) { return apvts.getRawParameterValue(parameterID)->load(); });
+}
+
+bool isChainSettingsParameter(const juce::String& parameterID)
+{
+    static const auto parameterIDs = []
+    {
+        juce::StringArray ids;
+        readChainSettings([&ids](juce::StringRef id) { ids.add(id); return 0.f; });
+        return ids;
+    }();
     
-    settings.lowCutSlope = static_cast<Slope>(apvts.getRawParameterValue("LowCut Slope")->load());
-    settings.highCutSlope = static_cast<Slope>(apvts.getRawParameterValue("HighCut Slope")->load());
+    return parameterIDs.contains(parameterID);
+}
+
+ChainSettingsDecoder::ChainSettingsDecoder(juce::AudioProcessorValueTreeState& apvts)
+{
+    for(auto* parameter : apvts.processor.getParameters())
+    {
+        if(auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter))
+        {
+            const auto& range = ranged->getNormalisableRange();
+            indices[ranged->getParameterID()] = static_cast<int>(ranges.size());
+            ranges.push_back(range);
+            defaults.push_back(range.convertFrom0to1(ranged->getDefaultValue()));
+        }
+    }
+}
+
+bool ChainSettingsDecoder::decode(const void* data, int sizeInBytes, ChainSettings& settings) const
+{
+    auto tree = juce::ValueTree::readFromData(data, static_cast<size_t>(sizeInBytes));
+    if(! tree.isValid())
+        return false;
     
+    // As replaceState(): each parameter reads the first child with its ID, and a value is
+    // clamped on its way into and back out of the parameter, then snapped to a legal value
+    // (a Band Type of 1.6 reads as 2).
+    auto values = defaults;
+    std::vector<bool> found(values.size());
     
+    for(const auto& child : tree)
+    {
+        auto index = indices.find(child.getProperty("id").toString());
+        if(index == indices.end() || found[static_cast<size_t>(index->second)])
+            continue;
+        
+        const auto i = static_cast<size_t>(index->second);
+        found[i] = true;
+        if(child.hasProperty("value"))
+        {
+            const auto& range = ranges[i];
+            values[i] = range.snapToLegalValue(range.convertFrom0to1(range.convertTo0to1(static_cast<float>(child.getProperty("value")))));
+        }
+    }
     
-    return settings;
+    settings = readChainSettings([this, &values](juce::StringRef parameterID)
+    {
+        return values[static_cast<size_t>(indices.at(juce::String(parameterID)))];
+    });
+    return true;
+}
+
+void setChainSettings(juce::AudioProcessorValueTreeState& apvts, const ChainSettings& settings)
+{
+    auto set = [&apvts](const juce::String& parameterID, float value)
+    {
+        if(auto* param = apvts.getParameter(parameterID))
+            param->setValueNotifyingHost(param->convertTo0to1(value));
+    };
+    
+    set("LowCut Freq", settings.lowCutFreq);
+    set("HighCut Freq", settings.highCutFreq);
+    set("LowCut Slope", static_cast<float>(settings.lowCutSlope));
+    set("HighCut Slope", static_cast<float>(settings.highCutSlope));
+    set("LowCut Channel", static_cast<float>(settings.lowCutChannel));
+    set("HighCut Channel", static_cast<float>(settings.highCutChannel));
+    set("Stereo Mode", static_cast<float>(settings.stereoMode));
+    set("Filter Design", static_cast<float>(settings.design));
+    
+    for(int i = 0; i < maxBands; ++i)
+    {
+        const auto& band = settings.bands[i];
+        set(getBandParameterID(i, Band_Freq), band.freq);
+        set(getBandParameterID(i, Band_Gain), band.gainInDecibels);
+        set(getBandParameterID(i, Band_Quality), band.quality);
+        set(getBandParameterID(i, Band_Enabled), band.enabled ? 1.f : 0.f);
+        set(getBandParameterID(i, Band_Type), static_cast<float>(band.type));
+        set(getBandParameterID(i, Band_Channel), static_cast<float>(band.channel));
+    }
+}
+
+BiquadCoefficients makeBandFilter(const BandSettings& bandSettings, double sampleRate, DesignMethod design)
+{
+    return makeBandCoefficients(bandSettings.type,
+                                bandSettings.freq,
+                                bandSettings.quality,
+                                bandSettings.gainInDecibels,
+                                sampleRate,
+                                design);
+}
+
+// Section i of an even order Butterworth filter has Q = 1 / (2 cos((2i + 1) pi / 2n)), as in
+// juce::dsp::FilterDesign.
+static int makeCutFilter(bool highPass, float freq, Slope slope, DesignMethod design, double sampleRate,
+                         CutCoefficients& sections)
+{
+    const int order = 2 * (slope + 1);
+    const int numSections = juce::jmin(order / 2, maxCutSections);
+    
+    for(int i = 0; i < numSections; ++i)
+    {
+        auto quality = 1.0 / (2.0 * std::cos((2.0 * i + 1.0) * juce::MathConstants<double>::pi / (2.0 * order)));
+        sections[i] = makeCutCoefficients(highPass, freq, quality, sampleRate, design);
+    }
+    
+    return numSections;
+}
+
+int makeLowCutFilter(const ChainSettings& chainSettings, double sampleRate, CutCoefficients& sections)
+{
+    return makeCutFilter(true, chainSettings.lowCutFreq, chainSettings.lowCutSlope, chainSettings.design, sampleRate, sections);
+}
+
+int makeHighCutFilter(const ChainSettings& chainSettings, double sampleRate, CutCoefficients& sections)
+{
+    return makeCutFilter(false, chainSettings.highCutFreq, chainSettings.highCutSlope, chainSettings.design, sampleRate, sections);
+}
+
+void ChainCoefficients::getMagnitudesSquared(int channel, const double* phi, double* magnitudesSquared, int numPoints) const noexcept
+{
+    const auto& kernels = getKernels();
+    std::fill(magnitudesSquared, magnitudesSquared + numPoints, 1.0);
+    
+    for(int i = 0; cutChannels[0][channel] && i < numLowCutSections; ++i)
+        kernels.multiplyMagnitudes(getBiquadMagnitudePolynomials(lowCut[i]), phi, magnitudesSquared, numPoints);
+    
+    for(int i = 0; i < numActiveBands[channel]; ++i)
+    {
+        auto band = activeBands[channel][i];
+        kernels.multiplyMagnitudes(getBandMagnitudeFunction(bandTypes[band])(bands[band]), phi, magnitudesSquared, numPoints);
+    }
+    
+    for(int i = 0; cutChannels[1][channel] && i < numHighCutSections; ++i)
+        kernels.multiplyMagnitudes(getBiquadMagnitudePolynomials(highCut[i]), phi, magnitudesSquared, numPoints);
+}
+
+int ChainCoefficients::getSections(int channel, std::array<BiquadCoefficients, maxChainSections>& sections) const noexcept
+{
+    int numSections = 0;
+    
+    for(int i = 0; cutChannels[0][channel] && i < numLowCutSections; ++i)
+        sections[numSections++] = lowCut[i];
+    
+    for(int i = 0; i < numActiveBands[channel]; ++i)
+        sections[numSections++] = bands[activeBands[channel][i]];
+    
+    for(int i = 0; cutChannels[1][channel] && i < numHighCutSections; ++i)
+        sections[numSections++] = highCut[i];
+    
+    return numSections;
+}
+
+// Whether the given channel of the pair runs a band or cut assigned to channel.
+static bool runsOnChannel(const ChainSettings& chainSettings, BandChannel channel, int index)
+{
+    return chainSettings.stereoMode == Stereo_Linked
+        || channel == Channel_Both
+        || channel == (index == 0 ? Channel_A : Channel_B);
+}
+
+bool updateChainCoefficients(ChainCoefficients& coefficients, const ChainSettings& chainSettings,
+                             const ChainSettings* previousSettings, double sampleRate)
+{
+    // A new design method redesigns everything.
+    if(previousSettings != nullptr && previousSettings->design != chainSettings.design)
+        previousSettings = nullptr;
+    
+    bool changed = previousSettings == nullptr || previousSettings->stereoMode != chainSettings.stereoMode
+                || previousSettings->lowCutChannel != chainSettings.lowCutChannel
+                || previousSettings->highCutChannel != chainSettings.highCutChannel;
+    
+    if(previousSettings == nullptr
+       || chainSettings.lowCutFreq != previousSettings->lowCutFreq
+       || chainSettings.lowCutSlope != previousSettings->lowCutSlope)
+    {
+        coefficients.numLowCutSections = makeLowCutFilter(chainSettings, sampleRate, coefficients.lowCut);
+        changed = true;
+    }
+    
+    if(previousSettings == nullptr
+       || chainSettings.highCutFreq != previousSettings->highCutFreq
+       || chainSettings.highCutSlope != previousSettings->highCutSlope)
+    {
+        coefficients.numHighCutSections = makeHighCutFilter(chainSettings, sampleRate, coefficients.highCut);
+        changed = true;
+    }
+    
+    for(int i = 0; i < maxBands; ++i)
+    {
+        const auto& band = chainSettings.bands[i];
+        if(previousSettings != nullptr && previousSettings->bands[i] == band)
+            continue;
+        
+        changed = true;
+        
+        // A disabled band is designed when it is switched back on, which changes its settings.
+        if(band.enabled)
+        {
+            coefficients.bands[i] = makeBandFilter(band, sampleRate, chainSettings.design);
+            coefficients.bandTypes[i] = getKernelType(band.type, chainSettings.design);
+        }
+    }
+    
+    if(! changed)
+        return false;
+    
+    coefficients.stereoMode = chainSettings.stereoMode;
+    coefficients.numActiveBands = {};
+    
+    for(int channel = 0; channel < 2; ++channel)
+    {
+        coefficients.cutChannels[0][channel] = runsOnChannel(chainSettings, chainSettings.lowCutChannel, channel);
+        coefficients.cutChannels[1][channel] = runsOnChannel(chainSettings, chainSettings.highCutChannel, channel);
+    }
+    
+    for(int i = 0; i < maxBands; ++i)
+    {
+        const auto& band = chainSettings.bands[i];
+        if(! band.enabled)
+            continue;
+        
+        for(int channel = 0; channel < 2; ++channel)
+            if(runsOnChannel(chainSettings, band.channel, channel))
+                coefficients.activeBands[channel][coefficients.numActiveBands[channel]++] = i;
+    }
+    
+    return true;
 }
 
-Coefficients makePeak1Filter(const ChainSettings& chainSettings, double sampleRate){
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate,
-                                                                                chainSettings.peak1Freq,
-                                                                                chainSettings.peak1Quality,
-                                                                                juce::Decibels::decibelsToGain(chainSettings.peak1GainInDecibels));
+//==============================================================================
+size_t StereoCascade::getArenaSize(int numChannels, int maxBlockSize) noexcept
+{
+    auto numBytes = InstanceArena::getSize<PairStates>(static_cast<size_t>((numChannels + 1) / 2));
+    
+    if(maxBlockSize >= minBlockRecursiveLength)
+        numBytes += InstanceArena::getSize<std::array<BlockCoefficients, maxSections>>(numLanes)
+                  + InstanceArena::getSize<std::array<BlockCoefficients, maxCutSections>>(2);
+    
+    return numBytes;
+}
+
+void StereoCascade::prepare(int numChannels, int maxBlockSize, InstanceArena& arena)
+{
+    pairStates = arena.allocate<PairStates>(static_cast<size_t>((numChannels + 1) / 2));
+    
+    if(maxBlockSize >= minBlockRecursiveLength)
+    {
+        blockCoefficients = arena.allocate<std::array<BlockCoefficients, maxSections>>(numLanes);
+        cutBlockCoefficients = arena.allocate<std::array<BlockCoefficients, maxCutSections>>(2);
+    }
+    else
+    {
+        blockCoefficients = {};
+        cutBlockCoefficients = {};
+    }
+    
+    blockCoefficientsValid = false;
 }
-Coefficients makePeak2Filter(const ChainSettings& chainSettings, double sampleRate){
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate,
-                                                                                chainSettings.peak2Freq,
-                                                                                chainSettings.peak2Quality,
-                                                                                juce::Decibels::decibelsToGain(chainSettings.peak2GainInDecibels));
+
+void StereoCascade::prepare(int numChannels)
+{
+    constexpr int maxBlockSize = std::numeric_limits<int>::max();
+    ownArena.reset(getArenaSize(numChannels, maxBlockSize));
+    prepare(numChannels, maxBlockSize, ownArena);
 }
-Coefficients makePeak3Filter(const ChainSettings& chainSettings, double sampleRate){
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate,
-                                                                                chainSettings.peak3Freq,
-                                                                                chainSettings.peak3Quality,
-                                                                                juce::Decibels::decibelsToGain(chainSettings.peak3GainInDecibels));
+
+void StereoCascade::reset()
+{
+    for(auto& states : pairStates)
+        states.lanes = {};
 }
-void FiveBandEQAudioProcessor::updatePeakFilter(const ChainSettings &chainSettings)
+
+void StereoCascade::setLayout(const ChainCoefficients& coefficients)
 {
-    auto peak1Coefficients = makePeak1Filter(chainSettings, getSampleRate());
-    auto peak2Coefficients = makePeak2Filter(chainSettings, getSampleRate());
-    auto peak3Coefficients = makePeak3Filter(chainSettings, getSampleRate());
+    struct Entry
+    {
+        BandType type;
+        const BiquadCoefficients* coefficients;
+        int state;
+    };
+    
+    std::array<std::array<Entry, maxSections>, numLanes> lanes;
+    std::array<int, numLanes> lengths {};
     
-//    *leftChain.get<ChainPositions::Peak1>().coefficients = *peak1Coefficients;
-//    *rightChain.get<ChainPositions::Peak1>().coefficients = *peak1Coefficients;
-    updateCoefficients(leftChain.get<ChainPositions::Peak1>().coefficients, peak1Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak1>().coefficients, peak1Coefficients);
+    for(int lane = 0; lane < numLanes; ++lane)
+    {
+        auto add = [&](BandType type, const BiquadCoefficients& c, int state)
+        {
+            lanes[lane][lengths[lane]++] = { type, &c, state };
+        };
+        
+        // A cut on this lane alone runs among its sections, in the lane's own states.
+        auto addCut = [&](int c)
+        {
+            if(coefficients.isCutShared(c) || ! coefficients.cutChannels[c][lane])
+                return;
+            
+            const auto& stages = c == 0 ? coefficients.lowCut : coefficients.highCut;
+            const auto numStages = c == 0 ? coefficients.numLowCutSections : coefficients.numHighCutSections;
+            for(int i = 0; i < numStages; ++i)
+                add(Biquad, stages[i], (c == 0 ? lowCutState : highCutState) + i);
+        };
+        
+        addCut(0);
+        for(int i = 0; i < coefficients.numActiveBands[lane]; ++i)
+        {
+            auto band = coefficients.activeBands[lane][i];
+            add(coefficients.bandTypes[band], coefficients.bands[band], bandState + band);
+        }
+        addCut(1);
+    }
+    
+    // Cut stages that have just started running start from silence. Cuts on both channels
+    // run on left and right, so a new stereo mode doesn't disturb them.
+    for(int c = 0; c < 2; ++c)
+    {
+        auto& cut = cuts[c];
+        auto numStages = c == 0 ? coefficients.numLowCutSections : coefficients.numHighCutSections;
+        if(! coefficients.isCutShared(c))
+            numStages = 0;
+        cut.firstState = c == 0 ? lowCutState : highCutState;
+        
+        for(int i = cut.numStages; i < numStages; ++i)
+            for(auto& states : pairStates)
+                for(auto& laneStates : states.lanes)
+                    laneStates[cut.firstState + i] = {};
+        
+        cut.coefficients = c == 0 ? coefficients.lowCut : coefficients.highCut;
+        cut.numStages = numStages;
+        cut.processPair = getCutFunction(numStages, false);
+        cut.processMono = getCutFunction(numStages, true);
+    }
+    
+    // Clear the state of anything that wasn't running before, of bands whose shape changed
+    // (the kernels don't all use both state variables) and of everything when the stereo
+    // mode changed, since the lanes then carry different signals.
+    std::array<std::array<bool, numStates + 1>, numLanes> wasRunning {};
+    for(int i = 0; i < numSections; ++i)
+        for(int lane = 0; lane < numLanes; ++lane)
+            wasRunning[lane][sections[i].state[lane]] = true;
+    
+    for(int lane = 0; lane < numLanes; ++lane)
+    {
+        for(int i = 0; i < lengths[lane]; ++i)
+        {
+            auto state = lanes[lane][i].state;
+            auto band = state - bandState;
+            bool shapeChanged = juce::isPositiveAndBelow(band, maxBands) && bandTypes[band] != coefficients.bandTypes[band];
+            
+            if(! wasRunning[lane][state] || shapeChanged || stereoMode != coefficients.stereoMode)
+                for(auto& states : pairStates)
+                    states.lanes[lane][state] = {};
+        }
+    }
     
+    bandTypes = coefficients.bandTypes;
+    stereoMode = coefficients.stereoMode;
     
-//    *leftChain.get<ChainPositions::Peak2>().coefficients = *peak2Coefficients;
-//    *rightChain.get<ChainPositions::Peak2>().coefficients = *peak2Coefficients;
-    updateCoefficients(leftChain.get<ChainPositions::Peak2>().coefficients, peak2Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak2>().coefficients, peak2Coefficients);
+    numSections = juce::jmax(lengths[0], lengths[1]);
+    numLaneSections = lengths;
+    blockCoefficientsValid = false;
+    const bool midSide = stereoMode == Stereo_MidSide;
     
-//    *leftChain.get<ChainPositions::Peak3>().coefficients = *peak3Coefficients;
-//    *rightChain.get<ChainPositions::Peak3>().coefficients = *peak3Coefficients;
-    updateCoefficients(leftChain.get<ChainPositions::Peak3>().coefficients, peak3Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak3>().coefficients, peak3Coefficients);
+    for(int i = 0; i < numSections; ++i)
+    {
+        auto& section = sections[i];
+        std::array<BandType, numLanes> types;
+        
+        for(int lane = 0; lane < numLanes; ++lane)
+        {
+            if(i < lengths[lane])
+            {
+                const auto& entry = lanes[lane][i];
+                section.coefficients[lane] = *entry.coefficients;
+                section.state[lane] = entry.state;
+                types[lane] = entry.type;
+            }
+            else
+            {
+                section.coefficients[lane] = {};
+                section.state[lane] = paddingState;
+                types[lane] = Biquad;
+            }
+        }
+        
+        // Both lanes share one kernel, so use the specialised one only when both lanes can run it.
+        auto type = Biquad;
+        if(i < lengths[0] && i < lengths[1])
+            type = types[0] == types[1] ? types[0] : Biquad;
+        else
+            type = i < lengths[0] ? types[0] : types[1];
+        
+        if(! acceptsIdentity(type) && (i >= lengths[0] || i >= lengths[1]))
+            type = Biquad;
+        
+        section.processPair = getSectionFunction(type, midSide && i == 0, midSide && i == numSections - 1);
+        section.processMono = i < lengths[0] ? getBandProcessFunction(types[0]) : nullptr;
+    }
 }
 
-void updateCoefficients(Coefficients &old, const Coefficients &replacements)
+void StereoCascade::getChainStates(int pair, ChainStates& chainStates) const noexcept
 {
-    *old = *replacements;
+    const auto& states = pairStates[static_cast<size_t>(pair)].lanes;
+    const bool midSide = stereoMode == Stereo_MidSide;
+    
+    for(int lane = 0; lane < numLanes; ++lane)
+    {
+        auto* out = chainStates[lane].data();
+        auto add = [&out](double s1, double s2)
+        {
+            *out++ = s1;
+            *out++ = s2;
+        };
+        
+        auto addCut = [&](const Cut& cut)
+        {
+            for(int i = 0; i < cut.numStages; ++i)
+            {
+                const auto& left = states[0][cut.firstState + i];
+                const auto& right = states[1][cut.firstState + i];
+                
+                if(! midSide)
+                    add(states[lane][cut.firstState + i].s1, states[lane][cut.firstState + i].s2);
+                else if(lane == 0)
+                    add(0.5 * (left.s1 + right.s1), 0.5 * (left.s2 + right.s2));
+                else
+                    add(0.5 * (left.s1 - right.s1), 0.5 * (left.s2 - right.s2));
+            }
+        };
+        
+        addCut(cuts[0]);
+        for(int i = 0; i < numLaneSections[lane]; ++i)
+        {
+            const auto& state = states[lane][sections[i].state[lane]];
+            add(state.s1, state.s2);
+        }
+        addCut(cuts[1]);
+    }
 }
 
-void FiveBandEQAudioProcessor::updateLowCutFilters(const ChainSettings &chainSettings)
+void StereoCascade::setChainStates(int pair, const ChainStates& chainStates) noexcept
 {
-    auto cutCoeficcients = makeLowCutFilter(chainSettings, getSampleRate());
-    auto& leftLowCut = leftChain.get<ChainPositions::LowCut>();
-    auto& rightLowCut = rightChain.get<ChainPositions::LowCut>();
+    auto& states = pairStates[static_cast<size_t>(pair)].lanes;
+    const bool midSide = stereoMode == Stereo_MidSide;
     
-    updateCutFilter(leftLowCut, cutCoeficcients, chainSettings.lowCutSlope);
-    updateCutFilter(rightLowCut, cutCoeficcients, chainSettings.lowCutSlope);
+    auto setCut = [&](const Cut& cut, std::array<int, numLanes> firstPosition)
+    {
+        for(int i = 0; i < cut.numStages; ++i)
+        {
+            const auto* a = chainStates[0].data() + 2 * (firstPosition[0] + i);
+            const auto* b = chainStates[1].data() + 2 * (firstPosition[1] + i);
+            
+            if(midSide)
+            {
+                states[0][cut.firstState + i] = { static_cast<float>(a[0] + b[0]), static_cast<float>(a[1] + b[1]) };
+                states[1][cut.firstState + i] = { static_cast<float>(a[0] - b[0]), static_cast<float>(a[1] - b[1]) };
+            }
+            else
+            {
+                states[0][cut.firstState + i] = { static_cast<float>(a[0]), static_cast<float>(a[1]) };
+                states[1][cut.firstState + i] = { static_cast<float>(b[0]), static_cast<float>(b[1]) };
+            }
+        }
+    };
+    
+    const auto numLowCut = cuts[0].numStages;
+    setCut(cuts[0], { 0, 0 });
+    setCut(cuts[1], { numLowCut + numLaneSections[0], numLowCut + numLaneSections[1] });
+    
+    for(int lane = 0; lane < numLanes; ++lane)
+    {
+        for(int i = 0; i < numLaneSections[lane]; ++i)
+        {
+            const auto* s = chainStates[lane].data() + 2 * (numLowCut + i);
+            states[lane][sections[i].state[lane]] = { static_cast<float>(s[0]), static_cast<float>(s[1]) };
+        }
+    }
 }
 
-void FiveBandEQAudioProcessor::updateHighCutFilters(const ChainSettings &chainSettings)
+template<BandType Type, bool Encode, bool Decode>
+void StereoCascade::processSection(const Section& section, LaneStates& laneStates,
+                                   float* left, float* right, int numSamples) noexcept
 {
-    auto highCutCoefficients = makeHighCutFilter(chainSettings, getSampleRate());
-    auto& rightHighCut = rightChain.get<ChainPositions::HighCut>();
-    auto& leftHighCut = leftChain.get<ChainPositions::HighCut>();
+    const auto c0 = section.coefficients[0];
+    const auto c1 = section.coefficients[1];
+    auto s0 = laneStates[0][section.state[0]];
+    auto s1 = laneStates[1][section.state[1]];
     
-    updateCutFilter(leftHighCut, highCutCoefficients, chainSettings.highCutSlope);
-    updateCutFilter(rightHighCut, highCutCoefficients, chainSettings.highCutSlope);
+    for(int i = 0; i < numSamples; ++i)
+    {
+        auto x0 = left[i];
+        auto x1 = right[i];
+        
+        if constexpr (Encode)
+        {
+            auto mid = 0.5f * (x0 + x1);
+            x1 = 0.5f * (x0 - x1);
+            x0 = mid;
+        }
+        
+        auto y0 = BandKernel<Type>::tick(c0, s0, x0);
+        auto y1 = BandKernel<Type>::tick(c1, s1, x1);
+        
+        if constexpr (Decode)
+        {
+            left[i] = y0 + y1;
+            right[i] = y0 - y1;
+        }
+        else
+        {
+            left[i] = y0;
+            right[i] = y1;
+        }
+    }
     
+    laneStates[0][section.state[0]] = s0;
+    laneStates[1][section.state[1]] = s1;
 }
 
-void FiveBandEQAudioProcessor::updateFilters()
+StereoCascade::SectionFunction StereoCascade::getSectionFunction(BandType type, bool encode, bool decode)
+{
+    #define FIVEBANDEQ_SECTION_FUNCTIONS(T) \
+        { &processSection<T, false, false>, &processSection<T, false, true>, \
+          &processSection<T, true, false>, &processSection<T, true, true> }
+    
+    static constexpr SectionFunction functions[NumBandTypes + 1][4]
+    {
+        FIVEBANDEQ_SECTION_FUNCTIONS(Peak),
+        FIVEBANDEQ_SECTION_FUNCTIONS(LowShelf),
+        FIVEBANDEQ_SECTION_FUNCTIONS(HighShelf),
+        FIVEBANDEQ_SECTION_FUNCTIONS(Notch),
+        FIVEBANDEQ_SECTION_FUNCTIONS(BandPass),
+        FIVEBANDEQ_SECTION_FUNCTIONS(Tilt),
+        FIVEBANDEQ_SECTION_FUNCTIONS(AllPass),
+        FIVEBANDEQ_SECTION_FUNCTIONS(Biquad)
+    };
+    
+    #undef FIVEBANDEQ_SECTION_FUNCTIONS
+    
+    return functions[type][(encode ? 2 : 0) + (decode ? 1 : 0)];
+}
+
+template<bool Mono, int... Stage>
+void StereoCascade::processCut(const Cut& cut, LaneStates& laneStates, float* left, float* right, int numSamples,
+                               std::integer_sequence<int, Stage...>) noexcept
+{
+    // Every stage index is a constant, so the coefficients and states stay in registers and
+    // each sample's stages overlap with the next sample's.
+    const BiquadCoefficients c[] { cut.coefficients[Stage]... };
+    BiquadState s0[] { laneStates[0][cut.firstState + Stage]... };
+    BiquadState s1[] { laneStates[1][cut.firstState + Stage]... };
+    
+    for(int i = 0; i < numSamples; ++i)
+    {
+        auto x0 = left[i];
+        ((x0 = BandKernel<Biquad>::tick(c[Stage], s0[Stage], x0)), ...);
+        left[i] = x0;
+        
+        if constexpr (! Mono)
+        {
+            auto x1 = right[i];
+            ((x1 = BandKernel<Biquad>::tick(c[Stage], s1[Stage], x1)), ...);
+            right[i] = x1;
+        }
+    }
+    
+    ((laneStates[0][cut.firstState + Stage] = s0[Stage]), ...);
+    if constexpr (! Mono)
+        ((laneStates[1][cut.firstState + Stage] = s1[Stage]), ...);
+}
+
+template<int NumStages, bool Mono>
+void StereoCascade::processCut(const Cut& cut, LaneStates& laneStates, float* left, float* right, int numSamples) noexcept
+{
+    processCut<Mono>(cut, laneStates, left, right, numSamples, std::make_integer_sequence<int, NumStages>());
+}
+
+StereoCascade::CutFunction StereoCascade::getCutFunction(int numStages, bool mono)
+{
+    #define FIVEBANDEQ_CUT_FUNCTIONS(N) { &processCut<N, false>, &processCut<N, true> }
+    
+    static_assert(maxCutSections == 8, "one kernel per stage count");
+    static constexpr CutFunction functions[maxCutSections + 1][2]
+    {
+        { nullptr, nullptr },
+        FIVEBANDEQ_CUT_FUNCTIONS(1),
+        FIVEBANDEQ_CUT_FUNCTIONS(2),
+        FIVEBANDEQ_CUT_FUNCTIONS(3),
+        FIVEBANDEQ_CUT_FUNCTIONS(4),
+        FIVEBANDEQ_CUT_FUNCTIONS(5),
+        FIVEBANDEQ_CUT_FUNCTIONS(6),
+        FIVEBANDEQ_CUT_FUNCTIONS(7),
+        FIVEBANDEQ_CUT_FUNCTIONS(8)
+    };
+    
+    #undef FIVEBANDEQ_CUT_FUNCTIONS
+    
+    return functions[numStages][mono ? 1 : 0];
+}
+
+void StereoCascade::prepareBlock(int numSamples) noexcept
+{
+    if(numSamples < minBlockRecursiveLength || blockCoefficientsValid || blockCoefficients.empty())
+        return;
+    
+    for(int lane = 0; lane < numLanes; ++lane)
+        for(int i = 0; i < numLaneSections[lane]; ++i)
+            blockCoefficients[lane][i] = makeBlockCoefficients(sections[i].coefficients[lane]);
+    
+    for(int c = 0; c < 2; ++c)
+        for(int i = 0; i < cuts[c].numStages; ++i)
+            cutBlockCoefficients[c][i] = makeBlockCoefficients(cuts[c].coefficients[i]);
+    
+    blockCoefficientsValid = true;
+}
+
+void StereoCascade::process(int pair, float* left, float* right, int numSamples) noexcept
+{
+    auto& states = pairStates[static_cast<size_t>(pair)].lanes;
+    
+    if(numSamples >= minBlockRecursiveLength && blockCoefficientsValid)
+    {
+        processBlockRecursive(states, left, right, numSamples);
+        return;
+    }
+    
+    if(right == nullptr)
+    {
+        if(cuts[0].processMono != nullptr)
+            cuts[0].processMono(cuts[0], states, left, nullptr, numSamples);
+        
+        for(int i = 0; i < numLaneSections[0]; ++i)
+        {
+            auto& section = sections[i];
+            section.processMono(section.coefficients[0], states[0][section.state[0]], left, numSamples);
+        }
+        
+        if(cuts[1].processMono != nullptr)
+            cuts[1].processMono(cuts[1], states, left, nullptr, numSamples);
+        return;
+    }
+    
+    if(cuts[0].processPair != nullptr)
+        cuts[0].processPair(cuts[0], states, left, right, numSamples);
+    
+    // With no sections the mid/side encode and decode would cancel anyway.
+    for(int i = 0; i < numSections; ++i)
+        sections[i].processPair(sections[i], states, left, right, numSamples);
+    
+    if(cuts[1].processPair != nullptr)
+        cuts[1].processPair(cuts[1], states, left, right, numSamples);
+}
+
+void StereoCascade::processBlockRecursive(LaneStates& states, float* left, float* right, int numSamples) noexcept
+{
+    jassert(blockCoefficientsValid);
+    
+    const auto& kernels = getKernels();
+    const int numChannels = right != nullptr ? numLanes : 1;
+    auto processCutBlocks = [&](int c)
+    {
+        for(int ch = 0; ch < numChannels; ++ch)
+            for(int i = 0; i < cuts[c].numStages; ++i)
+                kernels.processBlockRecursive(cutBlockCoefficients[c][i], states[ch][cuts[c].firstState + i],
+                                              ch == 0 ? left : right, numSamples);
+    };
+    
+    processCutBlocks(0);
+    
+    const bool midSide = right != nullptr && stereoMode == Stereo_MidSide && numSections > 0;
+    
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto mid = 0.5f * (left[i] + right[i]);
+            right[i] = 0.5f * (left[i] - right[i]);
+            left[i] = mid;
+        }
+    }
+    
+    for(int lane = 0; lane < numChannels; ++lane)
+    {
+        auto* data = lane == 0 ? left : right;
+        for(int i = 0; i < numLaneSections[lane]; ++i)
+            kernels.processBlockRecursive(blockCoefficients[lane][i], states[lane][sections[i].state[lane]], data, numSamples);
+    }
+    
+    if(midSide)
+    {
+        for(int i = 0; i < numSamples; ++i)
+        {
+            auto l = left[i] + right[i];
+            right[i] = left[i] - right[i];
+            left[i] = l;
+        }
+    }
+    
+    processCutBlocks(1);
+}
+
+ChainSettings FiveBandEQAudioProcessor::getDesignSettings()
 {
     auto chainSettings = getChainSettings(apvts);
     
-    updateLowCutFilters(chainSettings);
-    updatePeakFilter(chainSettings);
-    updateHighCutFilters(chainSettings);
+    if(getTotalNumOutputChannels() != 2)
+        chainSettings.stereoMode = Stereo_Linked;
+    
+    if(activeQuality == Render_DoubleMatched)
+        chainSettings.design = Design_Matched;
+    
+    return chainSettings;
+}
+
+void FiveBandEQAudioProcessor::updateFilters()
+{
+    FIVEBANDEQ_TRACE_SCOPE("updateFilters");
+    auto chainSettings = getDesignSettings();
+    
+    // Only redesign what actually moved since the last call; prepareToPlay clears
+    // designedSettingsValid so a new sample rate redesigns everything.
+    if(updateChainCoefficients(chainCoefficients, chainSettings,
+                               designedSettingsValid ? &designedSettings : nullptr, getSampleRate()))
+    {
+        if(activeQuality == Render_Live)
+        {
+            // The parallel form only knows its own layout; series knows what carries over.
+            if(parallelCascade->isRunning())
+                parallelCascade->handBack(cascade);
+            
+            cascade.setLayout(chainCoefficients);
+        }
+        else
+        {
+            doubleCascade->setLayout(chainCoefficients);
+        }
+        
+        ++layoutVersion;
+        publishCoefficients(false);
+    }
+    else if(publishedBypassed)
+    {
+        publishCoefficients(false);
+    }
+    
+    designedSettings = chainSettings;
+    designedSettingsValid = true;
 }
 
 juce::AudioProcessorValueTreeState::ParameterLayout FiveBandEQAudioProcessor::createParameterLayout()
 {
+    FIVEBANDEQ_TRACE_SCOPE("createParameterLayout");
     juce::AudioProcessorValueTreeState::ParameterLayout layout;
     
     layout.add(std::make_unique<juce::AudioParameterFloat>("LowCut Freq",
@@ -334,64 +1327,69 @@ juce::AudioProcessorValueTreeState::ParameterLayout FiveBandEQAudioProcessor::cr
                                                            juce::NormalisableRange<float>(20.f, 20000.f, 1.f, 0.25f),
                                                            20000.f));
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak1 Freq",
-                                                           "Peak1 Freq",
-                                                           juce::NormalisableRange<float>(20.f, 20000.f, 1.f, 0.25f),
-                                                           350.f));
-    
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak1 Gain",
-                                                           "Peak1 Gain",
-                                                           juce::NormalisableRange<float>(-24.f, 24.f, 0.5f, 1.f),
-                                                           0.0f));
+    // Bands 1-3 keep the defaults of the original three peaks and start enabled, the rest are
+    // spread evenly across the spectrum and start switched off.
+    const float legacyDefaultFreqs[] { 350.f, 2000.f, 5000.f };
+    const int numLegacyBands = 3;
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak1 Quality",
-                                                           "Peak1 Quality",
-                                                           juce::NormalisableRange<float>(0.1f, 10.f, 0.05f, 1.f),
-                                                           1.0f));
+    for(int i = 0; i < maxBands; ++i)
+    {
+        auto defaultFreq = i < numLegacyBands ? legacyDefaultFreqs[i]
+                                              : juce::mapToLog10((i + 0.5f) / maxBands, 20.f, 20000.f);
+        
+        layout.add(std::make_unique<juce::AudioParameterFloat>(getBandParameterID(i, Band_Freq),
+                                                               getBandParameterID(i, Band_Freq),
+                                                               juce::NormalisableRange<float>(20.f, 20000.f, 1.f, 0.25f),
+                                                               std::round(defaultFreq)));
+        
+        layout.add(std::make_unique<juce::AudioParameterFloat>(getBandParameterID(i, Band_Gain),
+                                                               getBandParameterID(i, Band_Gain),
+                                                               juce::NormalisableRange<float>(-24.f, 24.f, 0.5f, 1.f),
+                                                               0.0f));
+        
+        layout.add(std::make_unique<juce::AudioParameterFloat>(getBandParameterID(i, Band_Quality),
+                                                               getBandParameterID(i, Band_Quality),
+                                                               juce::NormalisableRange<float>(0.1f, 10.f, 0.05f, 1.f),
+                                                               1.0f));
+        
+        layout.add(std::make_unique<juce::AudioParameterBool>(getBandParameterID(i, Band_Enabled),
+                                                              getBandParameterID(i, Band_Enabled),
+                                                              i < numLegacyBands));
+        
+        layout.add(std::make_unique<juce::AudioParameterChoice>(getBandParameterID(i, Band_Type),
+                                                                getBandParameterID(i, Band_Type),
+                                                                getBandTypeNames(),
+                                                                BandType::Peak));
+        
+        layout.add(std::make_unique<juce::AudioParameterChoice>(getBandParameterID(i, Band_Channel),
+                                                                getBandParameterID(i, Band_Channel),
+                                                                getBandChannelNames(),
+                                                                Channel_Both));
+    }
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak2 Freq",
-                                                           "Peak2 Freq",
-                                                           juce::NormalisableRange<float>(20.f, 20000.f, 1.f, 0.25f),
-                                                           2000.f));
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak2 Gain",
-                                                           "Peak2 Gain",
-                                                           juce::NormalisableRange<float>(-24.f, 24.f, 0.5f, 1.f),
-                                                           0.0f));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("LowCut Slope", "LowCut Slope", getSlopeNames(), 0));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("HighCut Slope", "HighCut Slope", getSlopeNames(), 0));
+    // these two layout adds create a drop down to choose the slope for the plugin to change how intense the slope of the cutoff frequencies are
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak2 Quality",
-                                                           "Peak2 Quality",
-                                                           juce::NormalisableRange<float>(0.1f, 10.f, 0.05f, 1.f),
-                                                           1.0f));
+    // Which channels the cuts run on, as for the bands (ignored when linked). There is still
+    // one low and one high cut, so two channels can't have cuts at different frequencies.
+    layout.add(std::make_unique<juce::AudioParameterChoice>("LowCut Channel", "LowCut Channel", getBandChannelNames(), Channel_Both));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("HighCut Channel", "HighCut Channel", getBandChannelNames(), Channel_Both));
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak3 Freq",
-                                                           "Peak3 Freq",
-                                                           juce::NormalisableRange<float>(20.f, 20000.f, 1.f, 0.25f),
-                                                           5000.f));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("Stereo Mode", "Stereo Mode", getStereoModeNames(), Stereo_Linked));
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak3 Gain",
-                                                           "Peak3 Gain",
-                                                           juce::NormalisableRange<float>(-24.f, 24.f, 0.5f, 1.f),
-                                                           0.0f));
+    // Bilinear by default, so existing sessions sound the same.
+    layout.add(std::make_unique<juce::AudioParameterChoice>("Filter Design", "Filter Design", getDesignMethodNames(), Design_Bilinear));
     
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak3 Quality",
-                                                           "Peak3 Quality",
-                                                           juce::NormalisableRange<float>(0.1f, 10.f, 0.05f, 1.f),
-                                                           1.0f));
+    // Offline renders run in double precision unless asked not to: it sounds the same as
+    // playback, with less rounding noise.
+    layout.add(std::make_unique<juce::AudioParameterChoice>("Render Quality", "Render Quality", getRenderQualityNames(), Render_Double));
     
+    // Series until asked: the parallel form is faster but only as accurate as its tolerance.
+    layout.add(std::make_unique<juce::AudioParameterChoice>("Cascade Form", "Cascade Form", getCascadeFormNames(), Form_Series));
     
-    juce::StringArray stringArray;
-    for(int i = 0; i < 4; i++)
-    {
-        juce::String str;
-        str << (12 + i*12);
-        str << " db/Oct";
-        stringArray.add(str);
-    }
-    
-    layout.add(std::make_unique<juce::AudioParameterChoice>("LowCut Slope", "LowCut Slope", stringArray, 0));
-    layout.add(std::make_unique<juce::AudioParameterChoice>("HighCut Slope", "HighCut Slope", stringArray, 0));
-    // these two layout adds create a drop down to choose the slope for the plugin to change how intense the slope of the cutoff frequencies are
+    layout.add(std::make_unique<juce::AudioParameterBool>("Auto Gain", "Auto Gain", false));
     
     // skew factor allows slider to move differently *more slide for lower end than higher end*
     
@@ -9,107 +9,356 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "FilterKernels.h"
+#include "RealtimeWorkerPool.h"
+#include "LoudnessMeter.h"
+#include "InstanceArena.h"
 
 enum Slope
 {
     Slope_12,
     Slope_24,
     Slope_36,
-    Slope_48
+    Slope_48,
+    Slope_60,
+    Slope_72,
+    Slope_84,
+    Slope_96
+};
+
+constexpr int maxBands = 24;
+constexpr int maxChannels = 64;   // enough for 7th order ambisonics
+constexpr int maxCutSections = Slope_96 + 1;
+constexpr int maxChainSections = 2 * maxCutSections + maxBands;
+
+enum StereoMode
+{
+    Stereo_Linked,
+    Stereo_DualMono,
+    Stereo_MidSide
+};
+
+// Which channel of the pair a band runs on. Ignored when the channels are linked; in
+// mid/side mode the first channel is mid and the second is side.
+enum BandChannel
+{
+    Channel_Both,
+    Channel_A,
+    Channel_B
+};
+
+// What an offline render (AudioProcessor::isNonRealtime()) runs. Live playback always runs
+// the float cascade with the chosen design.
+enum RenderQuality
+{
+    Render_Live,            // the same as live playback
+    Render_Double,          // the double precision cascade
+    Render_DoubleMatched    // the double precision cascade with the matched designs
+};
+
+// How live playback runs the chain. The parallel form is only used when it is accurate
+// enough for the current layout; otherwise the series cascade keeps running.
+enum CascadeForm
+{
+    Form_Series,
+    Form_Parallel
+};
+
+const juce::StringArray& getStereoModeNames();
+const juce::StringArray& getBandChannelNames();
+const juce::StringArray& getSlopeNames();
+const juce::StringArray& getRenderQualityNames();
+const juce::StringArray& getCascadeFormNames();
+
+enum BandParameter
+{
+    Band_Freq,
+    Band_Gain,
+    Band_Quality,
+    Band_Enabled,
+    Band_Type,
+    Band_Channel,
+    NumBandParameters
+};
+
+struct BandSettings
+{
+    float freq { 1000.f }, gainInDecibels { 0 }, quality { 1.f };
+    bool enabled { false };
+    BandType type { BandType::Peak };
+    BandChannel channel { Channel_Both };
+    
+    bool operator==(const BandSettings& other) const
+    {
+        return freq == other.freq && gainInDecibels == other.gainInDecibels && quality == other.quality
+            && enabled == other.enabled && type == other.type && channel == other.channel;
+    }
+    bool operator!=(const BandSettings& other) const { return ! (*this == other); }
 };
 
 struct ChainSettings
 {
-    float peak1Freq{ 0 }, peak1GainInDecibels{ 0 }, peak1Quality{ 1.f };
-    float peak2Freq{ 0 }, peak2GainInDecibels{ 0 }, peak2Quality{ 1.f };
-    float peak3Freq{ 0 }, peak3GainInDecibels{ 0 }, peak3Quality{ 1.f };
+    std::array<BandSettings, maxBands> bands;
     
     float lowCutFreq { 0 }, highCutFreq { 0 };
     Slope lowCutSlope { Slope::Slope_12 }, highCutSlope { Slope::Slope_12 };
     
+    // Which channels of the pair each cut runs on, as for the bands. A cut on one channel of
+    // a mid/side pair runs inside the matrix, so a low cut on side alone keeps the bass mono.
+    BandChannel lowCutChannel { Channel_Both }, highCutChannel { Channel_Both };
+    
+    StereoMode stereoMode { Stereo_Linked };
+    
+    DesignMethod design { Design_Bilinear };
 };
 
+// Parameter IDs are "Peak<n> Freq", "Peak<n> Gain", ... with n starting at 1, so sessions
+// saved with the old three-peak layout still restore into the first three bands.
+const juce::String& getBandParameterID(int bandIndex, BandParameter parameter);
+
 ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts);
-using Filter = juce::dsp::IIR::Filter<float>;
+
+// Whether getChainSettings() reads the parameter, so a change to it changes the design.
+bool isChainSettingsParameter(const juce::String& parameterID);
+
+// Message thread only: pushes every value in settings to its parameter, notifying the host.
+void setChainSettings(juce::AudioProcessorValueTreeState& apvts, const ChainSettings& settings);
+
+// Decodes states saved by getStateInformation straight into ChainSettings, for the tools that
+// read whole preset libraries without a processor per state. decode() gives what
+// setStateInformation() and then getChainSettings() would: parameters the state doesn't have
+// take their defaults and every value goes through its parameter's range. Build it on the
+// message thread; decode() may then run on any number of threads at once.
+class ChainSettingsDecoder
+{
+public:
+    explicit ChainSettingsDecoder(juce::AudioProcessorValueTreeState& apvts);
     
-using CutFilter = juce::dsp::ProcessorChain<Filter, Filter, Filter, Filter>;
+    // Returns false if the data isn't a state at all.
+    bool decode(const void* data, int sizeInBytes, ChainSettings& settings) const;
     
-using MonoChain = juce::dsp::ProcessorChain<CutFilter, Filter, Filter, Filter, CutFilter>;
+private:
+    std::map<juce::String, int> indices;
+    std::vector<juce::NormalisableRange<float>> ranges;
+    std::vector<float> defaults;
+};
 
-enum ChainPositions
-    {
-        LowCut,
-        Peak1,
-        Peak2,
-        Peak3,
-        HighCut
-    };
+BiquadCoefficients makeBandFilter(const BandSettings& bandSettings, double sampleRate, DesignMethod design);
 
-using Coefficients = Filter::CoefficientsPtr;
-    
-void updateCoefficients(Coefficients& old, const Coefficients& replacements);
+// The cut filters as Butterworth cascades of second order sections, designed with
+// chainSettings.design. Return the number of sections.
+using CutCoefficients = std::array<BiquadCoefficients, maxCutSections>;
+int makeLowCutFilter(const ChainSettings& chainSettings, double sampleRate, CutCoefficients& sections);
+int makeHighCutFilter(const ChainSettings& chainSettings, double sampleRate, CutCoefficients& sections);
 
-Coefficients makePeak1Filter(const ChainSettings& chainSettings, double sampleRate);
-Coefficients makePeak2Filter(const ChainSettings& chainSettings, double sampleRate);
-Coefficients makePeak3Filter(const ChainSettings& chainSettings, double sampleRate);
-    template<int Index, typename ChainType, typename CoefficientType>
-    void update(ChainType& chain, const CoefficientType& Coefficients)
-    {
-        updateCoefficients(chain.template get<Index>().coefficients, Coefficients[Index]);
-        chain.template setBypassed<Index>(false);
-    }
+// Everything the cascade runs, designed once for both channels of the pair: a band's
+// coefficients only depend on its own settings, so the channels differ only in which
+// bands they list in activeBands and which cuts they run.
+struct ChainCoefficients
+{
+    CutCoefficients lowCut, highCut;
+    int numLowCutSections = 0, numHighCutSections = 0;
     
-    template<typename ChainType, typename CoefficientType>
-    void updateCutFilter(ChainType& chain, const CoefficientType& coefficients, const Slope& lowCutSlope)
-    {
+    // Whether each channel runs the low (0) and the high (1) cut. Both do unless the
+    // channels are independent and the cut was given to one of them.
+    std::array<std::array<bool, 2>, 2> cutChannels { { { { true, true } }, { { true, true } } } };
+    bool isCutShared(int cut) const noexcept { return cutChannels[cut][0] && cutChannels[cut][1]; }
+    
+    std::array<BiquadCoefficients, maxBands> bands;
+    std::array<BandType, maxBands> bandTypes {};
+    
+    std::array<std::array<int, maxBands>, 2> activeBands {};
+    std::array<int, 2> numActiveBands {};
+    
+    StereoMode stereoMode { Stereo_Linked };
+    
+    // |H|^2 of everything the given channel runs at each phi[k] = getPhi(freq, sampleRate),
+    // through the dispatched response kernels.
+    void getMagnitudesSquared(int channel, const double* phi, double* magnitudesSquared, int numPoints) const noexcept;
+    
+    // Copies the sections the given channel runs, in processing order, and returns how many.
+    int getSections(int channel, std::array<BiquadCoefficients, maxChainSections>& sections) const noexcept;
+};
 
-        
-        chain.template setBypassed<0>(true);
-        chain.template setBypassed<1>(true);
-        chain.template setBypassed<2>(true);
-        chain.template setBypassed<3>(true);
-        
-//        switch( chainSettings.lowCutSlope )
-        switch( lowCutSlope )
-        {
-            case Slope_48:
-            {
-                update<3>(chain, coefficients);
-            }
-                
-            case Slope_36:
-            {
-                update<2>(chain, coefficients);
-
-                
-            }
-            
-            case Slope_24:
-            {
-                update<1>(chain, coefficients);
-
-            }
-            
-            case Slope_12:
-            {
-                update<0>(chain, coefficients);
-
-            }
-        }
-    }
+// What the audio path is running, as the processor publishes it for the editor.
+struct CoefficientSnapshot
+{
+    ChainCoefficients coefficients;
+    double sampleRate = 0;
+    bool bypassed = false;
+    juce::uint32 layoutVersion = 0;   // counts the layouts the audio path has run
+};
+
+// The loudness of the input and of the EQ's output (before auto gain), and the auto gain
+// applied after it. Each reading is atomic on its own, so a copy may mix two 100 ms steps.
+struct LoudnessSnapshot
+{
+    LoudnessMeter::Readings input, output;
+    float autoGainDecibels = 0;
+};
 
-inline auto makeLowCutFilter(const ChainSettings& chainSettings, double sampleRate)
+// The bytes an instance has allocated, as far as the plug-in's own code can count them.
+// The parameters, the state tree, JUCE's component internals and the threads' stacks come
+// on top.
+struct MemoryFootprint
 {
-    return juce::dsp::FilterDesign<float>::designIIRHighpassHighOrderButterworthMethod(chainSettings.lowCutFreq,
-                                                                                                       sampleRate,
-                                                                                                       2*(chainSettings.lowCutSlope + 1));
-}
-inline auto makeHighCutFilter(const ChainSettings& chainSettings, double sampleRate)
+    size_t processor = 0;       // the processor and the engines it owns, with all they hold inline
+    size_t arena = 0;           // the states and block recursive coefficients for the prepared bus
+    size_t parallelForms = 0;   // the designed parallel forms' state maps
+    size_t matchEQ = 0;         // the analysis buffers, once a capture has started
+    size_t editor = 0;          // the open editor, with its share of the cached background
+    
+    size_t getTotal() const noexcept { return processor + arena + parallelForms + matchEQ + editor; }
+};
+
+// Redesigns whatever differs from previousSettings (everything when it is null).
+// Returns false if nothing changed.
+bool updateChainCoefficients(ChainCoefficients& coefficients, const ChainSettings& chainSettings,
+                             const ChainSettings* previousSettings, double sampleRate);
+
+// Runs the bands of both channels of a pair in a single pass, with the two channels side
+// by side in the lanes of each section, so the second channel costs little extra even
+// when the channels run different bands. In mid/side mode the encode is folded into the
+// first section and the decode into the last.
+//
+// A cut that runs on both channels is the same on each, so it commutes with the mid/side
+// matrix and runs on left and right, before and after the bands. Each such cut runs as one
+// pass through a kernel specialised on its number of stages, which keeps every stage's
+// state in registers and lets the stages of one sample overlap with the next, so a steep
+// cut costs little more than its sections' arithmetic and a cut that is off costs nothing.
+// A cut given to one channel joins that lane's sections instead, before or after its bands,
+// so in mid/side mode it filters mid or side alone.
+//
+// Blocks of at least minBlockRecursiveLength samples run each channel through the block
+// recursive kernel instead, which is several times faster per channel once a block is
+// long enough to amortise it (mono stems, offline renders with large buffers). Its
+// coefficients are most of a cascade's memory, so a cascade prepared for shorter blocks
+// doesn't keep them, and runs any longer block a host sends anyway one sample at a time.
+//
+// Wider buses are split into consecutive channel pairs (the last one may be a lone
+// channel) that share the layout but each have their own states, so different pairs
+// can be processed on different threads.
+class StereoCascade
 {
-    return juce::dsp::FilterDesign<float>::designIIRLowpassHighOrderButterworthMethod(chainSettings.highCutFreq,
-                                                                                                          sampleRate,
-                                                                                                          2*(chainSettings.highCutSlope + 1));
-}
+public:
+    static constexpr int numLanes = 2;
+    static constexpr int minBlockRecursiveLength = 32;
+    
+    // The arena space prepare() takes for a bus of numChannels channels and blocks of up to
+    // maxBlockSize samples.
+    static size_t getArenaSize(int numChannels, int maxBlockSize) noexcept;
+    
+    // Carves the states for a bus of numChannels channels from arena, and the block recursive
+    // coefficients if maxBlockSize is long enough to use them. Not real-time safe.
+    void prepare(int numChannels, int maxBlockSize, InstanceArena& arena);
+    
+    // As above, from an arena of the cascade's own and with the block recursive kernel, for
+    // cascades outside the processor.
+    void prepare(int numChannels);
+    void reset();
+    
+    int getNumPairs() const noexcept { return static_cast<int>(pairStates.size()); }
+    int getNumSections() const noexcept { return numSections + cuts[0].numStages + cuts[1].numStages; }
+    
+    // Rebuilds the section list. States belong to cut stages and bands rather than to
+    // positions, so a section that keeps running keeps its state and one that has just
+    // started running starts from silence.
+    void setLayout(const ChainCoefficients& coefficients);
+    
+    // Builds whatever the pairs share for a block of numSamples. Call it once per block,
+    // before the process() calls for that block.
+    void prepareBlock(int numSamples) noexcept;
+    
+    // right may be null for a lone channel, in which case only the first channel's sections
+    // run. Different pairs may be processed concurrently.
+    void process(int pair, float* left, float* right, int numSamples) noexcept;
+    
+    // The states of everything each lane of a pair runs, two per section in
+    // ChainCoefficients::getSections() order, as the lane sees its signal: in mid/side mode
+    // the states of cuts on both channels, which belong to left and right, are given as mid
+    // and side. For the engines that take over from this one and hand back to it.
+    using ChainStates = std::array<std::array<double, 2 * maxChainSections>, numLanes>;
+    void getChainStates(int pair, ChainStates& chainStates) const noexcept;
+    void setChainStates(int pair, const ChainStates& chainStates) noexcept;
+    
+private:
+    enum
+    {
+        lowCutState = 0,
+        bandState = lowCutState + maxCutSections,
+        highCutState = bandState + maxBands,
+        numStates = highCutState + maxCutSections,
+        paddingState = numStates,   // for a lane that has nothing to run at some position
+        maxSections = numStates
+    };
+    
+    using LaneStates = std::array<std::array<BiquadState, numStates + 1>, numLanes>;
+    struct Section;
+    using SectionFunction = void (*)(const Section&, LaneStates&, float*, float*, int);
+    
+    struct Section
+    {
+        std::array<BiquadCoefficients, numLanes> coefficients;
+        std::array<int, numLanes> state { { paddingState, paddingState } };
+        SectionFunction processPair = nullptr;
+        BandProcessFunction processMono = nullptr;
+    };
+    
+    template<BandType Type, bool Encode, bool Decode>
+    static void processSection(const Section& section, LaneStates& laneStates,
+                               float* left, float* right, int numSamples) noexcept;
+    static SectionFunction getSectionFunction(BandType type, bool encode, bool decode);
+    
+    struct Cut;
+    using CutFunction = void (*)(const Cut&, LaneStates&, float*, float*, int);
+    
+    // A cut on both channels. Lane 0 holds the left channel's cut states and lane 1 the
+    // right's, whatever the stereo mode.
+    struct Cut
+    {
+        CutCoefficients coefficients;
+        int numStages = 0;
+        int firstState = lowCutState;
+        CutFunction processPair = nullptr, processMono = nullptr;
+    };
+    
+    template<int NumStages, bool Mono>
+    static void processCut(const Cut& cut, LaneStates& laneStates, float* left, float* right, int numSamples) noexcept;
+    template<bool Mono, int... Stage>
+    static void processCut(const Cut& cut, LaneStates& laneStates, float* left, float* right, int numSamples,
+                           std::integer_sequence<int, Stage...>) noexcept;
+    static CutFunction getCutFunction(int numStages, bool mono);
+    
+    void processBlockRecursive(LaneStates& states, float* left, float* right, int numSamples) noexcept;
+    
+    std::array<Section, maxSections> sections;
+    int numSections = 0;
+    std::array<Cut, 2> cuts;   // low, high
+    std::array<int, numLanes> numLaneSections {};
+    
+    // Pairs may run on different threads, so each pair's states get their own cache lines.
+    struct alignas(64) PairStates
+    {
+        LaneStates lanes {};
+    };
+    ArenaArray<PairStates> pairStates;
+    
+    // Built from sections on the first long block after a layout change, so short-block
+    // processing never pays for them. Empty when the cascade was prepared for short blocks.
+    ArenaArray<std::array<BlockCoefficients, maxSections>> blockCoefficients;       // numLanes
+    ArenaArray<std::array<BlockCoefficients, maxCutSections>> cutBlockCoefficients; // low, high
+    bool blockCoefficientsValid = false;
+    
+    InstanceArena ownArena;
+    
+    std::array<BandType, maxBands> bandTypes {};
+    StereoMode stereoMode { Stereo_Linked };
+};
+
+class MatchEQ;
+class DoubleCascade;
+class ParallelCascade;
+class ParallelFormDesigner;
 
 //==============================================================================
 /**
@@ -124,12 +373,14 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void audioWorkgroupContextChanged (const juce::AudioWorkgroup& workgroup) override;
 
    #ifndef JucePlugin_PreferredChannelConfigurations
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlockBypassed (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -156,24 +407,91 @@ public:
     
     static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     juce::AudioProcessorValueTreeState apvts {*this, nullptr, "Parameters", createParameterLayout()};
+    
+    MatchEQ& getMatchEQ() { return *matchEQ; }
+    
+    // Copies the latest published snapshot if it is newer than version, and updates version.
+    // Lock-free and safe from any thread; returns false, leaving both untouched, when there
+    // is nothing new or a publish was in progress (try again later).
+    bool readCoefficientSnapshot(CoefficientSnapshot& snapshot, juce::uint32& version) const noexcept;
+    
+    // The settings updateFilters() designs from: linked unless the bus is stereo, and with
+    // the matched designs while an offline render asks for them.
+    ChainSettings getDesignSettings();
+    
+    // Counts the blocks processed, bypassed or not, so the editor can tell whether the host
+    // is calling processBlock at all. Lock-free, any thread.
+    juce::uint32 getNumProcessedBlocks() const noexcept { return numProcessedBlocks.load(std::memory_order_relaxed); }
+    
+    // Lock-free, any thread.
+    LoudnessSnapshot getLoudnessSnapshot() const noexcept;
+    void resetIntegratedLoudness() noexcept;
+    
+    // Message thread.
+    MemoryFootprint getMemoryFootprint() const;
 
 private:
     
     
-    MonoChain leftChain, rightChain;
+    ChainCoefficients chainCoefficients;
+    StereoCascade cascade;
+    RealtimeWorkerPool workerPool;
+    
+    // The engines' and meters' per-channel states and the block recursive coefficients, in
+    // one allocation that prepareToPlay sizes for the bus and the block size.
+    InstanceArena arena;
     
+    // Waking the workers costs more than running a few short cascades, so a block is only
+    // split across them when every pair has at least this many section-samples to do.
+    static constexpr int minWorkPerPairForWorkers = 4096;
+    static constexpr int maxWorkers = 3;
     
+    std::unique_ptr<MatchEQ> matchEQ;
     
-    void updatePeakFilter(const ChainSettings& chainSettings);
+    // Offline renders switch to the engine "Render Quality" asks for on the first block after
+    // the host calls setNonRealtime(true), and back on the first block after it ends. None of
+    // the engines add latency, so the host's delay compensation holds across the switch.
+    std::unique_ptr<DoubleCascade> doubleCascade;
+    std::atomic<float>* renderQualityParameter = nullptr;
+    std::atomic<RenderQuality> activeQuality { Render_Live };   // written by the audio thread
     
+    void updateRenderQuality() noexcept;
+    void updateFilters();
     
+    // Live playback runs the parallel form whenever "Cascade Form" asks for it and the
+    // designer has one for the layout the series cascade is running. Every new layout goes
+    // back to series first; layoutVersion tells the designer's forms apart.
+    std::unique_ptr<ParallelCascade> parallelCascade;
+    std::atomic<float>* cascadeFormParameter = nullptr;
+    juce::uint32 layoutVersion = 0;
     
-
+    void updateCascadeForm() noexcept;
     
-    void updateLowCutFilters(const ChainSettings& chainSettings);
-    void updateHighCutFilters(const ChainSettings& chainSettings);
+    ChainSettings designedSettings;
+    bool designedSettingsValid = false;
     
-    void updateFilters();
+    // A seqlock: the audio thread is the only writer and never waits, readers retry when
+    // the version was odd (a publish in progress) or moved while they copied.
+    void publishCoefficients(bool bypassed) noexcept;
+    CoefficientSnapshot publishedSnapshot;
+    std::atomic<juce::uint32> publishedVersion { 0 };
+    bool publishedBypassed = false;
+    std::atomic<juce::uint32> numProcessedBlocks { 0 };
+    
+    // Reads the snapshot from its own thread, so it has to go before the snapshot does.
+    std::unique_ptr<ParallelFormDesigner> parallelDesigner;
+    
+    // Auto gain follows the difference between the input's and the output's short-term
+    // loudness, so a boost or cut in the EQ doesn't change how loud the result is.
+    LoudnessMeter inputMeter, outputMeter;
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Multiplicative> autoGain { 1.f };
+    std::atomic<float> autoGainDecibels { 0.f };
+    std::atomic<float>* autoGainParameter = nullptr;
+    static constexpr float maxAutoGainDecibels = 24.f;
+    static constexpr double autoGainRampSeconds = 1.0;
+    
+    void updateAutoGain() noexcept;
+    void applyAutoGain(float* const* channels, int numChannels, int numSamples) noexcept;
     
     
     //==============================================================================
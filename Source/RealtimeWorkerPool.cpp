@@ -0,0 +1,216 @@
+/*
+  ==============================================================================
+
+    A small pool of worker threads for splitting one processBlock call across
+    cores.
+
+  ==============================================================================
+*/
+
+#include "RealtimeWorkerPool.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#else
+ #include <semaphore.h>
+ #include <cerrno>
+#endif
+
+#if JUCE_WINDOWS
+struct RealtimeWorkerPool::Semaphore::Native
+{
+    Native() : handle(CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr)) {}
+    ~Native() { CloseHandle(handle); }
+
+    void post() noexcept { ReleaseSemaphore(handle, 1, nullptr); }
+    void wait() noexcept { WaitForSingleObject(handle, INFINITE); }
+
+    HANDLE handle;
+};
+#elif JUCE_MAC || JUCE_IOS
+struct RealtimeWorkerPool::Semaphore::Native
+{
+    Native() : semaphore(dispatch_semaphore_create(0)) {}
+    ~Native() { dispatch_release(semaphore); }
+
+    void post() noexcept { dispatch_semaphore_signal(semaphore); }
+    void wait() noexcept { dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER); }
+
+    dispatch_semaphore_t semaphore;
+};
+#else
+struct RealtimeWorkerPool::Semaphore::Native
+{
+    Native() { sem_init(&semaphore, 0, 0); }
+    ~Native() { sem_destroy(&semaphore); }
+
+    void post() noexcept { sem_post(&semaphore); }
+
+    void wait() noexcept
+    {
+        while(sem_wait(&semaphore) != 0 && errno == EINTR) {}
+    }
+
+    sem_t semaphore;
+};
+#endif
+
+RealtimeWorkerPool::Semaphore::Semaphore() : native(std::make_unique<Native>()) {}
+RealtimeWorkerPool::Semaphore::~Semaphore() = default;
+
+void RealtimeWorkerPool::Semaphore::post() noexcept { native->post(); }
+void RealtimeWorkerPool::Semaphore::wait() noexcept { native->wait(); }
+
+RealtimeWorkerPool::~RealtimeWorkerPool()
+{
+    setNumWorkers(0);
+}
+
+void RealtimeWorkerPool::setNumWorkers(int numWorkers)
+{
+    numWorkers = juce::jmax(0, numWorkers);
+
+    while(static_cast<int>(workers.size()) > numWorkers)
+    {
+        auto& worker = workers.back();
+        worker->signalThreadShouldExit();
+        worker->wakeUp.post();
+        worker->stopThread(2000);
+        workers.pop_back();
+    }
+
+    while(static_cast<int>(workers.size()) < numWorkers)
+        startWorker();
+}
+
+void RealtimeWorkerPool::setAudioTiming(double newSampleRate, int newBlockSize)
+{
+    if(newSampleRate == sampleRate && newBlockSize == blockSize)
+        return;
+
+    sampleRate = newSampleRate;
+    blockSize = newBlockSize;
+    restartWorkers();
+}
+
+void RealtimeWorkerPool::setWorkgroup(const juce::AudioWorkgroup& newWorkgroup)
+{
+    {
+        const juce::SpinLock::ScopedLockType lock(workgroupLock);
+        if(newWorkgroup == workgroup)
+            return;
+
+        workgroup = newWorkgroup;
+    }
+
+    workgroupVersion.fetch_add(1, std::memory_order_release);
+}
+
+void RealtimeWorkerPool::startWorker()
+{
+    workers.push_back(std::make_unique<Worker>(*this));
+    auto& worker = *workers.back();
+
+    auto options = juce::Thread::RealtimeOptions{};
+    if(sampleRate > 0 && blockSize > 0)
+        options = options.withApproximateAudioProcessingTime(blockSize, sampleRate);
+
+    if(! worker.startRealtimeThread(options))
+        worker.startThread(juce::Thread::Priority::highest);
+}
+
+void RealtimeWorkerPool::restartWorkers()
+{
+    const auto numWorkers = getNumWorkers();
+    setNumWorkers(0);
+    setNumWorkers(numWorkers);
+}
+
+void RealtimeWorkerPool::execute(int n, TaskFunction f, void* c) noexcept
+{
+    const auto generation = (cursor.load(std::memory_order_relaxed) >> 32) + 1;
+
+    // The previous job was closed when it finished, so nobody can claim a task while the
+    // fields change; the release stores pair with the acquire loads in runTasks().
+    function.store(f, std::memory_order_release);
+    context.store(c, std::memory_order_release);
+    numTasks.store(n, std::memory_order_release);
+    numFinished.store(0, std::memory_order_relaxed);
+    cursor.store(generation << 32, std::memory_order_release);
+
+    for(auto& worker : workers)
+        worker->wakeUp.post();
+
+    runTasks(generation);
+
+    while(numFinished.load(std::memory_order_acquire) < n)
+        std::this_thread::yield();
+
+    cursor.store((generation << 32) | closed, std::memory_order_seq_cst);
+}
+
+void RealtimeWorkerPool::runTasks(juce::uint64 generation) noexcept
+{
+    auto* f = function.load(std::memory_order_acquire);
+    auto* c = context.load(std::memory_order_acquire);
+    const auto n = static_cast<juce::uint64>(numTasks.load(std::memory_order_acquire));
+
+    auto current = cursor.load(std::memory_order_acquire);
+
+    // If the fields above already belong to a newer job, the cursor has moved on to a
+    // different generation (or is closed) and nothing is claimed.
+    while((current >> 32) == generation && (current & closed) < n)
+    {
+        if(cursor.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel))
+        {
+            f(c, static_cast<int>(current & closed));
+            numFinished.fetch_add(1, std::memory_order_release);
+            current = cursor.load(std::memory_order_acquire);
+        }
+    }
+}
+
+void RealtimeWorkerPool::Worker::updateWorkgroup()
+{
+    const auto version = pool.workgroupVersion.load(std::memory_order_acquire);
+    if(version == workgroupVersion)
+        return;
+
+    juce::AudioWorkgroup current;
+    {
+        const juce::SpinLock::ScopedLockType lock(pool.workgroupLock);
+        current = pool.workgroup;
+    }
+
+    // Joining has to happen on the thread itself. The token leaves the workgroup when it is
+    // reset, or when the thread ends.
+    token.reset();
+    if(current)
+        current.join(token);
+
+    workgroupVersion = version;
+}
+
+void RealtimeWorkerPool::Worker::run()
+{
+    updateWorkgroup();
+
+    juce::uint64 lastGeneration = 0;
+
+    while(! threadShouldExit())
+    {
+        // Every job posts once per worker, so a worker that slept through a job finds
+        // its post still counted and only loops once more.
+        wakeUp.wait();
+        updateWorkgroup();
+
+        auto generation = pool.cursor.load(std::memory_order_acquire) >> 32;
+        if(generation != lastGeneration)
+        {
+            lastGeneration = generation;
+            pool.runTasks(generation);
+        }
+    }
+}
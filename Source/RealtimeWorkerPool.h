@@ -0,0 +1,134 @@
+/*
+  ==============================================================================
+
+    A small pool of worker threads for splitting one processBlock call across
+    cores.
+
+    run() publishes a job, wakes the workers and then works on the job itself,
+    taking tasks from a shared counter until none are left, so a job finishes
+    even if no worker wakes up in time. It then spins until the tasks the
+    workers took are done.
+
+    That wait is only as short as the workers are prompt, so they are started
+    as real-time threads with the host's buffer period as their deadline, and
+    join the host's audio workgroup when it offers one, so the OS schedules
+    them like the audio thread itself. A new workgroup is only recorded; each
+    worker leaves the old one and joins the new one itself the next time it
+    wakes, so no thread is stopped or started for it.
+
+    They sleep on native semaphores, whose post is lock-free when nobody
+    sleeps and a single system call otherwise, so the calling thread never
+    allocates or takes a lock. If the OS refuses
+    real-time threads (Linux without the rtprio limit, for example) the
+    workers fall back to the highest ordinary priority, and a worker pre-empted
+    after claiming a task can then hold the calling thread up.
+
+    Tasks are claimed from a cursor that packs the job's generation with the
+    next task index, and a finished job is closed before the next one is
+    published, so a worker that wakes up late can never run a task of the
+    wrong job.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class RealtimeWorkerPool
+{
+public:
+    RealtimeWorkerPool() = default;
+    ~RealtimeWorkerPool();
+
+    // Not real-time safe: starts or stops threads so that numWorkers are running.
+    void setNumWorkers(int numWorkers);
+    int getNumWorkers() const noexcept { return static_cast<int>(workers.size()); }
+
+    // Not real-time safe. The period the workers' deadline is taken from; running workers
+    // are restarted when it changes.
+    void setAudioTiming(double sampleRate, int blockSize);
+
+    // Any thread, the audio thread included: starts and stops nothing, and only waits for
+    // a worker copying the previous workgroup. The workers join it the next time they wake.
+    void setWorkgroup(const juce::AudioWorkgroup& workgroup);
+
+    // Calls task(i) for every i in [0, numTasks), spread over the workers and the calling
+    // thread, and returns once every call has finished. One job at a time.
+    template<typename Task>
+    void run(int numTasks, Task& task) noexcept
+    {
+        if(workers.empty() || numTasks < 2)
+        {
+            for(int i = 0; i < numTasks; ++i)
+                task(i);
+            return;
+        }
+
+        execute(numTasks, [](void* context, int index) { (*static_cast<Task*>(context))(index); }, &task);
+    }
+
+    // A counting semaphore from the OS, whose post never locks, so the audio thread can
+    // wake any thread with it.
+    class Semaphore
+    {
+    public:
+        Semaphore();
+        ~Semaphore();
+
+        void post() noexcept;
+        void wait() noexcept;
+
+    private:
+        struct Native;
+        std::unique_ptr<Native> native;
+
+        JUCE_DECLARE_NON_COPYABLE (Semaphore)
+    };
+
+private:
+    using TaskFunction = void (*)(void*, int);
+
+    struct Worker : juce::Thread
+    {
+        Worker(RealtimeWorkerPool& owner) : juce::Thread("EQ worker"), pool(owner) {}
+        void run() override;
+
+        // Leaves the workgroup the worker is in and joins the pool's, if that has changed.
+        void updateWorkgroup();
+
+        RealtimeWorkerPool& pool;
+        Semaphore wakeUp;
+        juce::WorkgroupToken token;
+        juce::uint32 workgroupVersion = 0;
+    };
+
+    void startWorker();
+    void restartWorkers();
+    void execute(int numTasks, TaskFunction function, void* context) noexcept;
+    void runTasks(juce::uint64 generation) noexcept;
+
+    static constexpr juce::uint64 closed = 0xffffffff;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // Only changed while no worker runs.
+    double sampleRate = 0;
+    int blockSize = 0;
+
+    // The lock is only held for a copy; the version tells the workers to copy it again.
+    juce::SpinLock workgroupLock;
+    juce::AudioWorkgroup workgroup;
+    std::atomic<juce::uint32> workgroupVersion { 0 };
+
+    // Written by the calling thread before the generation is published.
+    std::atomic<TaskFunction> function { nullptr };
+    std::atomic<void*> context { nullptr };
+    std::atomic<int> numTasks { 0 };
+
+    // Generation in the high 32 bits, next task index (or closed) in the low 32.
+    std::atomic<juce::uint64> cursor { closed };
+    std::atomic<int> numFinished { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeWorkerPool)
+};
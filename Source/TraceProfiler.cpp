@@ -0,0 +1,162 @@
+/*
+  ==============================================================================
+
+    Scoped trace markers exported as Chrome trace-event JSON.
+
+  ==============================================================================
+*/
+
+#include "TraceProfiler.h"
+
+#if FIVEBANDEQ_ENABLE_TRACING
+
+TraceProfiler& TraceProfiler::getInstance()
+{
+    static TraceProfiler instance;
+    return instance;
+}
+
+TraceProfiler::TraceProfiler()
+    : buffers(new ThreadBuffer[maxThreads])
+{
+}
+
+TraceProfiler::ThreadSlot::~ThreadSlot()
+{
+    if(buffer != nullptr)
+        buffer->inUse.store(false, std::memory_order_release);
+}
+
+TraceProfiler::ThreadBuffer* TraceProfiler::claimThreadBuffer() noexcept
+{
+    // Rings never used come first, so the events of threads that have ended are kept as
+    // long as there is room.
+    ThreadBuffer* buffer = nullptr;
+
+    for(int pass = 0; pass < 2 && buffer == nullptr; ++pass)
+    {
+        for(int i = 0; i < maxThreads && buffer == nullptr; ++i)
+        {
+            auto& candidate = buffers[static_cast<size_t>(i)];
+            if(pass == 0 && candidate.sequence.load(std::memory_order_relaxed) != 0)
+                continue;
+
+            bool expected = false;
+            if(candidate.inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                buffer = &candidate;
+        }
+    }
+
+    if(buffer == nullptr)
+        return nullptr;
+
+    // Copying a juce::String only takes a reference, and the copy into the ring is bounded.
+    const auto sequence = buffer->sequence.load(std::memory_order_relaxed);
+    buffer->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    buffer->threadID = juce::Thread::getCurrentThreadId();
+    buffer->threadName[0] = 0;
+    buffer->messageThread = juce::MessageManager::existsAndIsCurrentThread();
+    if(auto* thread = juce::Thread::getCurrentThread())
+        thread->getThreadName().copyToUTF8(buffer->threadName, sizeof(buffer->threadName));
+    buffer->firstEvent = buffer->numWritten.load(std::memory_order_relaxed);
+
+    buffer->sequence.store(sequence + 2, std::memory_order_release);
+    return buffer;
+}
+
+void TraceProfiler::record(const char* name, juce::int64 start, juce::int64 end) noexcept
+{
+    // Claimed once, on the thread's first event: a host audio thread isn't a juce::Thread,
+    // so there is nowhere else to hook it. The slot gives the ring back when the thread ends.
+    static thread_local ThreadSlot slot;
+
+    if(! slot.claimed)
+    {
+        slot.buffer = claimThreadBuffer();
+        slot.claimed = true;
+    }
+
+    auto* threadBuffer = slot.buffer;
+    if(threadBuffer == nullptr)
+        return;
+
+    auto index = threadBuffer->numWritten.load(std::memory_order_relaxed);
+    threadBuffer->events[index % eventsPerThread] = { name, start, end };
+    threadBuffer->numWritten.store(index + 1, std::memory_order_release);
+}
+
+juce::String TraceProfiler::createJson() const
+{
+    const auto ticksToUs = 1.0e6 / static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+
+    juce::String json;
+    json.preallocateBytes(static_cast<size_t>(maxThreads) * eventsPerThread * 80);
+    json << "{\"traceEvents\":[\n";
+
+    bool first = true;
+    auto addEvent = [&json, &first](const juce::String& event)
+    {
+        json << (first ? "" : ",\n") << event;
+        first = false;
+    };
+
+    for(int tid = 0; tid < maxThreads; ++tid)
+    {
+        const auto& buffer = buffers[static_cast<size_t>(tid)];
+
+        // Skipped if it was never claimed, or if another thread claims it while this reads.
+        const auto sequence = buffer.sequence.load(std::memory_order_acquire);
+        if(sequence == 0 || (sequence & 1) != 0)
+            continue;
+
+        const auto threadID = buffer.threadID;
+        const auto messageThread = buffer.messageThread;
+        const auto firstEvent = buffer.firstEvent;
+        auto threadName = juce::String::fromUTF8(buffer.threadName);
+
+        // The thread keeps writing while this reads, so copy first and then drop whatever
+        // it may have overwritten in the meantime.
+        auto end = buffer.numWritten.load(std::memory_order_acquire);
+        auto begin = end > eventsPerThread ? end - eventsPerThread : 0u;
+        begin = juce::jmax(begin, juce::jmin(firstEvent, end));
+
+        std::vector<Event> events;
+        events.reserve(end - begin);
+        for(auto i = begin; i < end; ++i)
+            events.push_back(buffer.events[i % eventsPerThread]);
+
+        auto written = buffer.numWritten.load(std::memory_order_acquire);
+        auto firstIntact = written >= eventsPerThread ? written - eventsPerThread + 1 : 0u;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(buffer.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+
+        if(threadName.isEmpty())
+            threadName = messageThread ? juce::String("Message thread")
+                                       : "Thread " + juce::String::toHexString(reinterpret_cast<juce::pointer_sized_int>(threadID));
+
+        addEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + juce::String(tid)
+                 + ",\"args\":{\"name\":" + juce::JSON::toString(threadName) + "}}");
+
+        for(auto i = juce::jmax(begin, firstIntact); i < end; ++i)
+        {
+            const auto& event = events[i - begin];
+            addEvent("{\"name\":\"" + juce::String(event.name) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + juce::String(tid)
+                     + ",\"ts\":" + juce::String(static_cast<double>(event.start) * ticksToUs, 3)
+                     + ",\"dur\":" + juce::String(static_cast<double>(event.end - event.start) * ticksToUs, 3) + "}");
+        }
+    }
+
+    json << "\n]}\n";
+    return json;
+}
+
+bool TraceProfiler::writeToFile(const juce::File& file) const
+{
+    return file.replaceWithText(createJson());
+}
+
+#endif
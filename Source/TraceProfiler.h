@@ -0,0 +1,107 @@
+/*
+  ==============================================================================
+
+    Scoped trace markers for the audio, worker and message threads, exported
+    as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+
+    Everything here compiles to nothing unless FIVEBANDEQ_ENABLE_TRACING is
+    defined to 1 (add it to the preprocessor definitions in Projucer).
+
+    Each thread writes its events into its own fixed-size ring, claimed on the
+    thread's first event, so recording never locks or allocates and threads
+    never contend. Once a ring is full its oldest events are overwritten, so a
+    dump shows the most recent few seconds of every thread. A ring is given
+    back when its thread ends (the workers and the designer thread come and go
+    with every prepareToPlay and Cascade Form switch) and keeps that thread's
+    events until another thread takes it. Claiming copies the thread's ID and,
+    for a juce::Thread, its name into the ring; the JSON strings are only
+    built by createJson(). The only allocation left is the few bytes the C++
+    runtime may take, once per thread, to register the thread's exit hook.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef FIVEBANDEQ_ENABLE_TRACING
+ #define FIVEBANDEQ_ENABLE_TRACING 0
+#endif
+
+#if FIVEBANDEQ_ENABLE_TRACING
+
+class TraceProfiler
+{
+public:
+    static constexpr int maxThreads = 32;           // live at once; events from any further threads are dropped
+    static constexpr int eventsPerThread = 1 << 14;
+
+    static TraceProfiler& getInstance();
+
+    // Records the time from construction to destruction. name must outlive the profiler
+    // (a string literal).
+    struct Scope
+    {
+        explicit Scope(const char* eventName) noexcept
+            : name(eventName), start(juce::Time::getHighResolutionTicks()) {}
+        ~Scope() noexcept { getInstance().record(name, start, juce::Time::getHighResolutionTicks()); }
+
+        const char* name;
+        juce::int64 start;
+    };
+
+    void record(const char* name, juce::int64 start, juce::int64 end) noexcept;
+
+    // Message thread (or any non-recording thread): a snapshot of every thread's ring.
+    juce::String createJson() const;
+    bool writeToFile(const juce::File& file) const;
+
+private:
+    TraceProfiler();
+
+    struct Event
+    {
+        const char* name;
+        juce::int64 start, end;
+    };
+
+    struct ThreadBuffer
+    {
+        std::atomic<bool> inUse { false };
+
+        // Odd while a thread is claiming the ring, even once its details below are written
+        // (zero while the ring has never been claimed).
+        std::atomic<juce::uint32> sequence { 0 };
+        juce::Thread::ThreadID threadID = {};
+        char threadName[64] = {};
+        bool messageThread = false;
+        juce::uint32 firstEvent = 0;    // the owner's first event; those before are a previous owner's
+
+        std::atomic<juce::uint32> numWritten { 0 };
+        std::array<Event, eventsPerThread> events;
+    };
+
+    // Gives the thread's ring back when the thread ends.
+    struct ThreadSlot
+    {
+        ~ThreadSlot();
+
+        ThreadBuffer* buffer = nullptr;
+        bool claimed = false;
+    };
+
+    ThreadBuffer* claimThreadBuffer() noexcept;
+
+    std::unique_ptr<ThreadBuffer[]> buffers;
+
+    JUCE_DECLARE_NON_COPYABLE (TraceProfiler)
+};
+
+ #define FIVEBANDEQ_TRACE_SCOPE(name) TraceProfiler::Scope JUCE_JOIN_MACRO (traceScope, __LINE__) (name)
+
+#else
+
+ #define FIVEBANDEQ_TRACE_SCOPE(name)
+
+#endif
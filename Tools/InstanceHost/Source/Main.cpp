@@ -0,0 +1,418 @@
+/*
+  ==============================================================================
+
+    Instance-density stress host.
+
+    Loads more and more FiveBandEQAudioProcessor instances into one process,
+    the way a large session fills a machine, and finds how many still meet
+    the audio deadline. Every instance gets its own random settings and its
+    own stereo buffer, and a simulated device thread calls each instance's
+    processBlock once per callback, paced at the real buffer period.
+
+    Every instance is loaded the way a host recalls a session: constructed,
+    given a saved state, prepared and run for a first block, and with
+    --editors given an editor. The mean time of each of those phases is
+    reported with the session's total load time.
+
+    Instances are added --step at a time. After each step the callbacks run
+    for --seconds-per-step; a callback misses its deadline when processing
+    every instance takes longer than --budget-fraction of the buffer period.
+    A step passes while at most --max-miss-rate of its callbacks miss, and
+    the capacity is the largest instance count that passed.
+
+    With --editors every instance also gets an editor, created offscreen.
+    Their timers run on the main thread while the device thread is busy, and
+    --visible-editors of them are painted into an image at 30 Hz, as a host
+    would paint the windows that are open.
+
+    Memory is read from the process' resident set (Linux), so the figures
+    include everything an instance allocates: chains, coefficients, buffers,
+    and with --editors the components and their cached images. The run ends
+    with the footprint the instances report themselves, part by part, to
+    compare against it.
+
+    Usage:
+      InstanceHost [--sample-rate 48000] [--block-size 64] [--step 8]
+                   [--max-instances 4096] [--seconds-per-step 2]
+                   [--budget-fraction 0.8] [--max-miss-rate 0.001]
+                   [--editors] [--visible-editors 1] [--unpaced]
+                   [--min-instances 0] [--seed 1]
+
+    The exit code is non-zero if the capacity is below --min-instances, so
+    a release build can gate on it.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+
+namespace
+{
+    struct Options
+    {
+        double sampleRate = 48000.0;
+        int blockSize = 64;
+        int step = 8;
+        int maxInstances = 4096;
+        double secondsPerStep = 2.0;
+        double budgetFraction = 0.8;
+        double maxMissRate = 0.001;
+        bool editors = false;
+        int visibleEditors = 1;
+        bool paced = true;
+        int minInstances = 0;
+        juce::int64 seed = 1;
+    };
+
+    Options parseOptions(const juce::ArgumentList& args)
+    {
+        Options options;
+
+        auto read = [&args](const juce::String& name, auto& value)
+        {
+            if(args.containsOption(name))
+                value = static_cast<std::decay_t<decltype(value)>>(args.getValueForOption(name).getDoubleValue());
+        };
+
+        read("--sample-rate", options.sampleRate);
+        read("--block-size", options.blockSize);
+        read("--step", options.step);
+        read("--max-instances", options.maxInstances);
+        read("--seconds-per-step", options.secondsPerStep);
+        read("--budget-fraction", options.budgetFraction);
+        read("--max-miss-rate", options.maxMissRate);
+        read("--visible-editors", options.visibleEditors);
+        read("--min-instances", options.minInstances);
+        read("--seed", options.seed);
+        options.editors = args.containsOption("--editors");
+        options.paced = ! args.containsOption("--unpaced");
+
+        options.step = juce::jmax(1, options.step);
+        options.blockSize = juce::jmax(1, options.blockSize);
+
+        return options;
+    }
+
+    // The resident set in bytes, or 0 where /proc isn't available.
+    juce::int64 getResidentBytes()
+    {
+        juce::StringArray lines;
+        lines.addLines(juce::File("/proc/self/status").loadFileAsString());
+
+        for(const auto& line : lines)
+            if(line.startsWith("VmRSS:"))
+                return line.fromFirstOccurrenceOf(":", false, false).trim().getLargeIntValue() * 1024;
+
+        return 0;
+    }
+
+    double getPercentile(std::vector<double> values, double percentile)
+    {
+        if(values.empty())
+            return 0.0;
+
+        auto index = static_cast<size_t>(percentile / 100.0 * static_cast<double>(values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return values[index];
+    }
+
+    struct Instance
+    {
+        std::unique_ptr<FiveBandEQAudioProcessor> processor;
+        std::unique_ptr<juce::AudioProcessorEditor> editor;
+        juce::AudioBuffer<float> buffer;
+        double processUs = 0;     // summed over the current step
+    };
+
+    // The audio device: one callback per buffer period, every instance in turn.
+    struct DeviceThread : juce::Thread
+    {
+        DeviceThread(std::vector<Instance>& i, const Options& o, int callbacks)
+            : juce::Thread("Simulated device"), instances(i), options(o), numCallbacks(callbacks)
+        {
+            callbackUs.reserve(static_cast<size_t>(numCallbacks));
+
+            // A few seconds of noise to copy from, so every callback sees fresh input
+            // without generating it inside the timed loop.
+            juce::Random random(options.seed);
+            noise.resize(static_cast<size_t>(options.sampleRate * 4));
+            for(auto& sample : noise)
+                sample = random.nextFloat() * 2.f - 1.f;
+        }
+
+        void run() override
+        {
+            const auto ticksPerSecond = static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+            const auto ticksToUs = 1.0e6 / ticksPerSecond;
+            const auto periodTicks = static_cast<juce::int64>(ticksPerSecond * options.blockSize / options.sampleRate);
+
+            juce::MidiBuffer midi;
+            size_t readPosition = 0;
+            auto nextCallback = juce::Time::getHighResolutionTicks();
+
+            for(int callback = 0; callback < numCallbacks && ! threadShouldExit(); ++callback)
+            {
+                if(options.paced)
+                {
+                    // Sleep through most of the wait and spin the last millisecond, as a
+                    // device callback arrives on time whatever the scheduler's granularity.
+                    for(auto now = juce::Time::getHighResolutionTicks(); now < nextCallback; now = juce::Time::getHighResolutionTicks())
+                    {
+                        if(static_cast<double>(nextCallback - now) * ticksToUs > 2000.0)
+                            juce::Thread::sleep(1);
+                        else
+                            juce::Thread::yield();
+                    }
+                    nextCallback += periodTicks;
+                }
+
+                if(readPosition + static_cast<size_t>(options.blockSize) > noise.size())
+                    readPosition = 0;
+
+                auto callbackStart = juce::Time::getHighResolutionTicks();
+
+                for(auto& instance : instances)
+                {
+                    for(int ch = 0; ch < instance.buffer.getNumChannels(); ++ch)
+                        instance.buffer.copyFrom(ch, 0, noise.data() + readPosition, options.blockSize);
+
+                    auto start = juce::Time::getHighResolutionTicks();
+                    instance.processor->processBlock(instance.buffer, midi);
+                    instance.processUs += static_cast<double>(juce::Time::getHighResolutionTicks() - start) * ticksToUs;
+                }
+
+                auto callbackEnd = juce::Time::getHighResolutionTicks();
+                callbackUs.push_back(static_cast<double>(callbackEnd - callbackStart) * ticksToUs);
+
+                // A late callback pushes the next one back rather than bunching the catch-up.
+                if(options.paced && callbackEnd > nextCallback)
+                    nextCallback = callbackEnd;
+
+                readPosition += static_cast<size_t>(options.blockSize);
+            }
+        }
+
+        std::vector<Instance>& instances;
+        const Options& options;
+        const int numCallbacks;
+        std::vector<float> noise;
+        std::vector<double> callbackUs;
+    };
+
+    void randomiseParameters(FiveBandEQAudioProcessor& processor, juce::Random& random)
+    {
+        for(auto* param : processor.getParameters())
+            param->setValue(random.nextFloat());
+    }
+
+    // Time spent in each phase of loading an instance, summed over every instance.
+    struct LoadTimes
+    {
+        enum Phase
+        {
+            Construct,
+            SetState,
+            Prepare,
+            FirstBlock,
+            Editor,
+            NumPhases
+        };
+
+        std::array<double, NumPhases> ms {};
+
+        template<typename Function>
+        void time(Phase phase, Function&& function)
+        {
+            auto start = juce::Time::getMillisecondCounterHiRes();
+            function();
+            ms[phase] += juce::Time::getMillisecondCounterHiRes() - start;
+        }
+    };
+
+    juce::String megabytes(double bytes)
+    {
+        return juce::String(bytes / (1024.0 * 1024.0), 1);
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto options = parseOptions(juce::ArgumentList(argc, argv));
+    juce::Random random(options.seed);
+
+    const auto periodUs = 1.0e6 * options.blockSize / options.sampleRate;
+    const auto budgetUs = options.budgetFraction * periodUs;
+    const auto numCallbacks = juce::jmax(1, static_cast<int>(options.secondsPerStep * options.sampleRate / options.blockSize));
+
+    std::cout << "period   (us)     " << periodUs << "\n"
+              << "budget   (us)     " << budgetUs << "\n"
+              << "sizeof processor  " << sizeof(FiveBandEQAudioProcessor) << " bytes\n"
+              << "sizeof cascade    " << sizeof(StereoCascade) << " bytes\n"
+              << "sizeof chain      " << sizeof(ChainCoefficients) << " bytes\n\n"
+              << "instances  mean (us)  p99.9 (us)  worst (us)  misses  per instance (us)  rss (MB)\n";
+
+    std::vector<Instance> instances;
+    instances.reserve(static_cast<size_t>(options.maxInstances));
+
+    // The session's saved states, so every instance is recalled rather than left at the defaults.
+    std::vector<juce::MemoryBlock> states(32);
+    {
+        FiveBandEQAudioProcessor scratch;
+        for(auto& state : states)
+        {
+            randomiseParameters(scratch, random);
+            scratch.getStateInformation(state);
+        }
+    }
+
+    LoadTimes loadTimes;
+    juce::AudioBuffer<float> silence(2, options.blockSize);
+    juce::MidiBuffer midi;
+
+    const auto baseResidentBytes = getResidentBytes();
+    juce::int64 processorBytes = 0, editorBytes = 0;
+    double paintMs = 0;
+    int numPaints = 0, capacity = 0;
+
+    while(static_cast<int>(instances.size()) < options.maxInstances)
+    {
+        auto target = juce::jmin(options.maxInstances, static_cast<int>(instances.size()) + options.step);
+
+        while(static_cast<int>(instances.size()) < target)
+        {
+            auto before = getResidentBytes();
+
+            Instance instance;
+            const auto& state = states[static_cast<size_t>(random.nextInt(static_cast<int>(states.size())))];
+
+            loadTimes.time(LoadTimes::Construct, [&] { instance.processor = std::make_unique<FiveBandEQAudioProcessor>(); });
+            loadTimes.time(LoadTimes::SetState, [&] { instance.processor->setStateInformation(state.getData(), static_cast<int>(state.getSize())); });
+            loadTimes.time(LoadTimes::Prepare, [&]
+            {
+                instance.processor->setPlayConfigDetails(2, 2, options.sampleRate, options.blockSize);
+                instance.processor->prepareToPlay(options.sampleRate, options.blockSize);
+            });
+            loadTimes.time(LoadTimes::FirstBlock, [&]
+            {
+                silence.clear();
+                instance.processor->processBlock(silence, midi);
+            });
+            instance.buffer.setSize(2, options.blockSize);
+
+            auto afterProcessor = getResidentBytes();
+            processorBytes += afterProcessor - before;
+
+            if(options.editors)
+            {
+                loadTimes.time(LoadTimes::Editor, [&] { instance.editor.reset(instance.processor->createEditorIfNeeded()); });
+                editorBytes += getResidentBytes() - afterProcessor;
+            }
+
+            instances.push_back(std::move(instance));
+        }
+
+        for(auto& instance : instances)
+            instance.processUs = 0;
+
+        DeviceThread device(instances, options, numCallbacks);
+        device.startThread(juce::Thread::Priority::highest);
+
+        // The message thread keeps the editors' timers running and paints the open ones,
+        // competing with the device thread as a host's UI does.
+        const auto visibleEditors = options.editors ? juce::jmin(options.visibleEditors, static_cast<int>(instances.size())) : 0;
+        while(device.isThreadRunning())
+        {
+            juce::Timer::callPendingTimersSynchronously();
+
+            for(int i = 0; i < visibleEditors; ++i)
+            {
+                auto* editor = instances[static_cast<size_t>(i)].editor.get();
+                auto start = juce::Time::getMillisecondCounterHiRes();
+                editor->createComponentSnapshot(editor->getLocalBounds());
+                paintMs += juce::Time::getMillisecondCounterHiRes() - start;
+                ++numPaints;
+            }
+
+            juce::Thread::sleep(33);
+        }
+        device.stopThread(-1);
+
+        const auto& times = device.callbackUs;
+        const auto misses = std::count_if(times.begin(), times.end(), [budgetUs](double t) { return t > budgetUs; });
+        const auto meanUs = std::accumulate(times.begin(), times.end(), 0.0) / static_cast<double>(times.size());
+        const auto numInstances = static_cast<int>(instances.size());
+        const auto perInstanceUs = std::accumulate(instances.begin(), instances.end(), 0.0,
+                                                   [](double sum, const Instance& i) { return sum + i.processUs; })
+                                   / (static_cast<double>(numInstances) * static_cast<double>(times.size()));
+
+        std::cout << juce::String(numInstances).paddedLeft(' ', 9)
+                  << juce::String(meanUs, 1).paddedLeft(' ', 11)
+                  << juce::String(getPercentile(times, 99.9), 1).paddedLeft(' ', 12)
+                  << juce::String(*std::max_element(times.begin(), times.end()), 1).paddedLeft(' ', 12)
+                  << juce::String(static_cast<int>(misses)).paddedLeft(' ', 8)
+                  << juce::String(perInstanceUs, 2).paddedLeft(' ', 19)
+                  << megabytes(static_cast<double>(getResidentBytes())).paddedLeft(' ', 10) << std::endl;
+
+        if(static_cast<double>(misses) > options.maxMissRate * static_cast<double>(times.size()))
+            break;
+
+        capacity = numInstances;
+    }
+
+    //==============================================================================
+    const auto numCreated = static_cast<double>(juce::jmax<size_t>(1, instances.size()));
+
+    std::cout << "\ncapacity          " << capacity << " instances"
+              << (capacity == options.maxInstances ? " (--max-instances reached)" : "") << "\n"
+              << "memory / instance " << megabytes(static_cast<double>(processorBytes) / numCreated) << " MB\n"
+              << "load (us / instance)\n"
+              << "  constructor     " << 1000.0 * loadTimes.ms[LoadTimes::Construct] / numCreated << "\n"
+              << "  set state       " << 1000.0 * loadTimes.ms[LoadTimes::SetState] / numCreated << "\n"
+              << "  prepareToPlay   " << 1000.0 * loadTimes.ms[LoadTimes::Prepare] / numCreated << "\n"
+              << "  first block     " << 1000.0 * loadTimes.ms[LoadTimes::FirstBlock] / numCreated << "\n";
+
+    if(options.editors)
+        std::cout << "  editor          " << 1000.0 * loadTimes.ms[LoadTimes::Editor] / numCreated << "\n";
+
+    std::cout << "session load (ms) " << std::accumulate(loadTimes.ms.begin(), loadTimes.ms.end(), 0.0) << "\n";
+
+    if(options.editors)
+        std::cout << "memory / editor   " << megabytes(static_cast<double>(editorBytes) / numCreated) << " MB\n"
+                  << "editor paint (ms) " << (numPaints > 0 ? paintMs / numPaints : 0.0) << "\n";
+
+    std::cout << "total rss growth  " << megabytes(static_cast<double>(getResidentBytes() - baseResidentBytes)) << " MB\n";
+
+    MemoryFootprint reported;
+    for(const auto& instance : instances)
+    {
+        auto footprint = instance.processor->getMemoryFootprint();
+        reported.processor += footprint.processor;
+        reported.arena += footprint.arena;
+        reported.parallelForms += footprint.parallelForms;
+        reported.matchEQ += footprint.matchEQ;
+        reported.editor += footprint.editor;
+    }
+
+    auto perInstance = [numCreated](size_t bytes) { return juce::String(static_cast<double>(bytes) / numCreated, 0); };
+    std::cout << "reported / instance (bytes)\n"
+              << "  processor       " << perInstance(reported.processor) << "\n"
+              << "  arena           " << perInstance(reported.arena) << "\n"
+              << "  parallel forms  " << perInstance(reported.parallelForms) << "\n"
+              << "  match EQ        " << perInstance(reported.matchEQ) << "\n"
+              << "  editor          " << perInstance(reported.editor) << "\n"
+              << "  total           " << perInstance(reported.getTotal()) << std::endl;
+
+    // Editors first, as a host closes windows before unloading plug-ins.
+    for(auto& instance : instances)
+        instance.editor.reset();
+    for(auto& instance : instances)
+        instance.processor->releaseResources();
+    instances.clear();
+
+    return capacity >= options.minInstances ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+  ==============================================================================
+
+    Chunk-parallel offline render of a single long file.
+
+    Reads an audio file, filters it with the plug-in's current settings (the
+    defaults, or a state saved with getStateInformation) and writes a 32 bit
+    float WAV. The file is streamed in segments, and each segment is split
+    into chunks that OfflineRenderer filters on every core and then stitches
+    together exactly, so one long file renders about as fast as many short
+    ones would in parallel.
+
+    --verify also renders the file sequentially through the plug-in's
+    cascade and reports the largest difference between the two renders. The
+    exit code is non-zero if it is above the tolerance, -100 dB relative to
+    the sequential render's peak unless --tolerance-db says otherwise: both
+    renders are float, so they should only differ by rounding.
+
+    Usage:
+      OfflineRender --input in.wav --output out.wav [--preset state.bin]
+                    [--chunk-seconds 1] [--threads <cores>]
+                    [--verify [--tolerance-db -100]]
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+#include "../../../Source/OfflineRenderer.h"
+
+namespace
+{
+    struct Options
+    {
+        juce::String input, output, preset;
+        double chunkSeconds = 1.0;
+        int numThreads = juce::SystemStats::getNumCpus();
+        bool verify = false;
+        double toleranceDecibels = -100.0;   // re the sequential render's peak
+    };
+
+    Options parseOptions(const juce::ArgumentList& args)
+    {
+        Options options;
+
+        options.input = args.getValueForOption("--input");
+        options.output = args.getValueForOption("--output");
+        options.preset = args.getValueForOption("--preset");
+
+        if(args.containsOption("--chunk-seconds"))
+            options.chunkSeconds = args.getValueForOption("--chunk-seconds").getDoubleValue();
+        if(args.containsOption("--threads"))
+            options.numThreads = args.getValueForOption("--threads").getIntValue();
+        options.verify = args.containsOption("--verify");
+        if(args.containsOption("--tolerance-db"))
+            options.toleranceDecibels = args.getValueForOption("--tolerance-db").getDoubleValue();
+
+        return options;
+    }
+
+    int fail(const juce::String& message)
+    {
+        std::cerr << message << std::endl;
+        return 1;
+    }
+
+    // The reference the chunked render has to match: the plug-in's cascade, one block after another.
+    struct SequentialRender
+    {
+        SequentialRender(const ChainCoefficients& coefficients, int numChannels)
+        {
+            cascade.prepare(numChannels);
+            cascade.reset();
+            cascade.setLayout(coefficients);
+        }
+
+        void process(juce::AudioBuffer<float>& buffer)
+        {
+            constexpr int blockSize = 4096;
+            auto* const* channels = buffer.getArrayOfWritePointers();
+            const auto numChannels = buffer.getNumChannels();
+
+            for(int start = 0; start < buffer.getNumSamples(); start += blockSize)
+            {
+                auto numSamples = juce::jmin(blockSize, buffer.getNumSamples() - start);
+                cascade.prepareBlock(numSamples);
+
+                for(int pair = 0; pair < cascade.getNumPairs(); ++pair)
+                    cascade.process(pair, channels[2 * pair] + start,
+                                    2 * pair + 1 < numChannels ? channels[2 * pair + 1] + start : nullptr,
+                                    numSamples);
+            }
+        }
+
+        StereoCascade cascade;
+    };
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto options = parseOptions(juce::ArgumentList(argc, argv));
+    if(options.input.isEmpty() || options.output.isEmpty())
+        return fail("usage: OfflineRender --input in.wav --output out.wav [--preset state.bin] "
+                    "[--chunk-seconds 1] [--threads <cores>] [--verify [--tolerance-db -100]]");
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(juce::File(options.input)));
+    if(reader == nullptr)
+        return fail("can't read " + options.input);
+
+    const auto sampleRate = reader->sampleRate;
+    const auto numChannels = static_cast<int>(reader->numChannels);
+    const auto length = reader->lengthInSamples;
+
+    if(numChannels > maxChannels)
+        return fail("the plug-in supports up to " + juce::String(maxChannels) + " channels");
+
+    FiveBandEQAudioProcessor processor;
+    if(options.preset.isNotEmpty())
+    {
+        juce::MemoryBlock state;
+        if(! juce::File(options.preset).loadFileAsData(state))
+            return fail("can't read " + options.preset);
+        processor.setStateInformation(state.getData(), static_cast<int>(state.getSize()));
+    }
+
+    // As processBlock does, other bus widths run linked.
+    auto settings = getChainSettings(processor.apvts);
+    if(numChannels != 2)
+        settings.stereoMode = Stereo_Linked;
+
+    ChainCoefficients coefficients;
+    updateChainCoefficients(coefficients, settings, nullptr, sampleRate);
+
+    juce::File outputFile(options.output);
+    outputFile.deleteFile();
+    std::unique_ptr<juce::OutputStream> outputStream(outputFile.createOutputStream());
+    if(outputStream == nullptr)
+        return fail("can't write " + options.output);
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(juce::WavAudioFormat().createWriterFor(outputStream.get(), sampleRate,
+                                                                                          static_cast<unsigned int>(numChannels),
+                                                                                          32, {}, 0));
+    if(writer == nullptr)
+        return fail("can't write " + options.output);
+    outputStream.release();   // the writer owns it now
+
+    RealtimeWorkerPool pool;
+    pool.setNumWorkers(juce::jmax(0, options.numThreads - 1));
+
+    const auto chunkLength = juce::jmax(StereoCascade::minBlockRecursiveLength,
+                                        juce::roundToInt(options.chunkSeconds * sampleRate));
+    OfflineRenderer renderer(coefficients, numChannels, chunkLength);
+
+    // A few chunks per thread per segment keeps every core busy without reading the whole file.
+    const auto segmentLength = chunkLength * 4 * juce::jmax(1, options.numThreads);
+    juce::AudioBuffer<float> buffer(numChannels, segmentLength), reference;
+
+    std::unique_ptr<SequentialRender> sequential;
+    if(options.verify)
+    {
+        sequential = std::make_unique<SequentialRender>(coefficients, numChannels);
+        reference.setSize(numChannels, segmentLength);
+    }
+
+    double renderSeconds = 0, maxDifference = 0, peak = 0;
+
+    for(juce::int64 start = 0; start < length; start += segmentLength)
+    {
+        auto numSamples = static_cast<int>(juce::jmin<juce::int64>(segmentLength, length - start));
+        reader->read(&buffer, 0, numSamples, start, true, true);
+
+        if(options.verify)
+            for(int ch = 0; ch < numChannels; ++ch)
+                reference.copyFrom(ch, 0, buffer, ch, 0, numSamples);
+
+        auto renderStart = juce::Time::getHighResolutionTicks();
+        renderer.process(buffer.getArrayOfWritePointers(), numSamples, pool);
+        renderSeconds += juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - renderStart);
+
+        if(options.verify)
+        {
+            juce::AudioBuffer<float> view(reference.getArrayOfWritePointers(), numChannels, numSamples);
+            sequential->process(view);
+
+            for(int ch = 0; ch < numChannels; ++ch)
+                for(int i = 0; i < numSamples; ++i)
+                {
+                    maxDifference = juce::jmax(maxDifference, static_cast<double>(std::abs(buffer.getSample(ch, i) - view.getSample(ch, i))));
+                    peak = juce::jmax(peak, static_cast<double>(std::abs(view.getSample(ch, i))));
+                }
+        }
+
+        writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+    }
+
+    writer.reset();
+    pool.setNumWorkers(0);
+
+    const auto audioSeconds = static_cast<double>(length) / sampleRate;
+    std::cout << "audio    (s)      " << audioSeconds << "\n"
+              << "render   (s)      " << renderSeconds << "\n"
+              << "speed    (x rt)   " << audioSeconds / juce::jmax(renderSeconds, 1.0e-9) << "\n";
+
+    bool passed = true;
+
+    if(options.verify)
+    {
+        const auto relativeDecibels = juce::Decibels::gainToDecibels(maxDifference / juce::jmax(peak, 1.0e-30), -300.0);
+        passed = relativeDecibels <= options.toleranceDecibels;
+
+        std::cout << "max difference   " << juce::Decibels::gainToDecibels(maxDifference, -300.0) << " dB ("
+                  << relativeDecibels << " dB re peak, tolerance " << options.toleranceDecibels << " dB)  "
+                  << (passed ? "PASS" : "FAIL") << "\n";
+    }
+
+    std::cout << std::flush;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+/*
+  ==============================================================================
+
+    Batch analysis of a preset library.
+
+    Finds every state saved with getStateInformation under a directory,
+    decodes each one straight into ChainSettings and evaluates the magnitude
+    response of each lane at several sample rates, with every point of a
+    section computed at once through the dispatched response kernels. The
+    presets are spread over every core. For each one it reports:
+
+      - the peak gain over the grid at any of the rates,
+      - the power gain: the mean of |H|^2 over the log-spaced points, that is
+        how much louder material with equal energy per octave comes out, and
+        so the clipping risk for a full-range mix,
+      - cramping: the largest difference between each rate's response and the
+        highest rate's, as bilinear designs squash a band's shape towards
+        Nyquist at the lower rates. Levels below -60 dB count as -60 dB, so a
+        deep notch that moves a little doesn't dominate.
+
+    The grid runs from 20 Hz to 20 kHz, or to just below the lowest rate's
+    Nyquist frequency. Presets over --max-boost, --headroom or --max-cramping
+    are listed as outliers, worst first, and the exit code is non-zero if
+    there are any or a file isn't a state at all.
+
+    Usage:
+      PresetAnalyzer --presets <dir> [--pattern *] [--rates 44100,48000,96000]
+                     [--points 4096] [--threads <cores>] [--max-boost 18]
+                     [--headroom 6] [--max-cramping 3] [--list 20]
+                     [--report report.csv] [--curves <dir>]
+
+    --report writes one CSV row per preset. --curves writes each preset's
+    response in dB, one column per rate and lane, to <dir>/<preset>.csv.
+    Presets that aren't linked have two lanes, A and B, as the bands'
+    Channel parameter names them (left or mid, right or side).
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+
+namespace
+{
+    struct Options
+    {
+        juce::String presets, pattern { "*" }, report, curves;
+        std::vector<double> rates { 44100.0, 48000.0, 96000.0 };
+        int numPoints = 4096;
+        int numThreads = juce::SystemStats::getNumCpus();
+        double maxBoost = 18.0, headroom = 6.0, maxCramping = 3.0;
+        int listLength = 20;
+    };
+
+    Options parseOptions(const juce::ArgumentList& args)
+    {
+        Options options;
+
+        auto read = [&args](const juce::String& name, auto& value)
+        {
+            if(args.containsOption(name))
+                value = static_cast<std::decay_t<decltype(value)>>(args.getValueForOption(name).getDoubleValue());
+        };
+
+        options.presets = args.getValueForOption("--presets");
+        if(args.containsOption("--pattern"))
+            options.pattern = args.getValueForOption("--pattern");
+        options.report = args.getValueForOption("--report");
+        options.curves = args.getValueForOption("--curves");
+
+        if(args.containsOption("--rates"))
+        {
+            options.rates.clear();
+            for(const auto& rate : juce::StringArray::fromTokens(args.getValueForOption("--rates"), ",", ""))
+                if(rate.getDoubleValue() > 0)
+                    options.rates.push_back(rate.getDoubleValue());
+        }
+        std::sort(options.rates.begin(), options.rates.end());
+
+        read("--points", options.numPoints);
+        read("--threads", options.numThreads);
+        read("--max-boost", options.maxBoost);
+        read("--headroom", options.headroom);
+        read("--max-cramping", options.maxCramping);
+        read("--list", options.listLength);
+
+        return options;
+    }
+
+    int fail(const juce::String& message)
+    {
+        std::cerr << message << std::endl;
+        return 1;
+    }
+
+    // The points every preset is evaluated at, and their phi at each rate. Read only once built.
+    struct Grid
+    {
+        Grid(const std::vector<double>& sampleRates, int numPoints)
+            : rates(sampleRates), freqs(static_cast<size_t>(numPoints)), phis(sampleRates.size())
+        {
+            const auto maxFreq = juce::jmin(20000.0, 0.49 * rates.front());
+            for(size_t i = 0; i < freqs.size(); ++i)
+                freqs[i] = juce::mapToLog10(static_cast<double>(i) / juce::jmax(1.0, static_cast<double>(freqs.size() - 1)), 20.0, maxFreq);
+
+            for(size_t r = 0; r < rates.size(); ++r)
+                for(auto freq : freqs)
+                    phis[r].push_back(getPhi(freq, rates[r]));
+        }
+
+        int getNumRates() const noexcept { return static_cast<int>(rates.size()); }
+        int getNumPoints() const noexcept { return static_cast<int>(freqs.size()); }
+
+        std::vector<double> rates, freqs;
+        std::vector<std::vector<double>> phis;
+    };
+
+    enum Flag
+    {
+        Flag_Boost = 1,
+        Flag_Clipping = 2,
+        Flag_Cramping = 4
+    };
+
+    struct Analysis
+    {
+        bool decoded = false;
+        double peakGain = -300, peakFreq = 0, peakRate = 0;
+        double powerGain = -300;
+        double cramping = 0, crampingFreq = 0, crampingRate = 0;
+        int flags = 0;
+        double excess = -300;   // the furthest it goes past a threshold, in dB (positive for an outlier)
+    };
+
+    constexpr double crampingFloor = -60.0;
+
+    // levels gets the response in dB, rate by rate and lane by lane, getNumPoints() each.
+    Analysis analyse(const ChainSettings& settings, const Grid& grid, const Options& options, std::vector<double>& levels)
+    {
+        Analysis analysis;
+        analysis.decoded = true;
+
+        const int numLanes = settings.stereoMode == Stereo_Linked ? 1 : 2;
+        const int numRates = grid.getNumRates();
+        const int numPoints = grid.getNumPoints();
+        levels.resize(static_cast<size_t>(numRates * numLanes * numPoints));
+
+        ChainCoefficients coefficients;
+
+        for(int r = 0; r < numRates; ++r)
+        {
+            const auto rate = grid.rates[static_cast<size_t>(r)];
+            updateChainCoefficients(coefficients, settings, nullptr, rate);
+
+            for(int lane = 0; lane < numLanes; ++lane)
+            {
+                auto* level = levels.data() + (r * numLanes + lane) * numPoints;
+                coefficients.getMagnitudesSquared(lane, grid.phis[static_cast<size_t>(r)].data(), level, numPoints);
+
+                if(r == numRates - 1)
+                {
+                    auto power = std::accumulate(level, level + numPoints, 0.0) / juce::jmax(1, numPoints);
+                    analysis.powerGain = juce::jmax(analysis.powerGain, 10.0 * std::log10(juce::jmax(power, 1.0e-30)));
+                }
+
+                for(int i = 0; i < numPoints; ++i)
+                {
+                    level[i] = 10.0 * std::log10(juce::jmax(level[i], 1.0e-30));
+                    if(level[i] > analysis.peakGain)
+                    {
+                        analysis.peakGain = level[i];
+                        analysis.peakFreq = grid.freqs[static_cast<size_t>(i)];
+                        analysis.peakRate = rate;
+                    }
+                }
+            }
+        }
+
+        const auto* reference = levels.data() + (numRates - 1) * numLanes * numPoints;
+        for(int r = 0; r < numRates - 1; ++r)
+        {
+            const auto* level = levels.data() + r * numLanes * numPoints;
+            for(int i = 0; i < numLanes * numPoints; ++i)
+            {
+                auto difference = std::abs(juce::jmax(level[i], crampingFloor) - juce::jmax(reference[i], crampingFloor));
+                if(difference > analysis.cramping)
+                {
+                    analysis.cramping = difference;
+                    analysis.crampingFreq = grid.freqs[static_cast<size_t>(i % numPoints)];
+                    analysis.crampingRate = grid.rates[static_cast<size_t>(r)];
+                }
+            }
+        }
+
+        auto check = [&analysis](double value, double threshold, Flag flag)
+        {
+            if(value > threshold)
+                analysis.flags |= flag;
+            analysis.excess = juce::jmax(analysis.excess, value - threshold);
+        };
+
+        check(analysis.peakGain, options.maxBoost, Flag_Boost);
+        check(analysis.powerGain, options.headroom, Flag_Clipping);
+        check(analysis.cramping, options.maxCramping, Flag_Cramping);
+
+        return analysis;
+    }
+
+    juce::String getFlagNames(const Analysis& analysis)
+    {
+        if(! analysis.decoded)
+            return "undecodable";
+
+        juce::StringArray names;
+        if(analysis.flags & Flag_Boost)     names.add("boost");
+        if(analysis.flags & Flag_Clipping)  names.add("clipping");
+        if(analysis.flags & Flag_Cramping)  names.add("cramping");
+        return names.joinIntoString(" ");
+    }
+
+    void writeCurves(const juce::File& file, const Grid& grid, int numLanes, const std::vector<double>& levels)
+    {
+        juce::String text("freq");
+        for(auto rate : grid.rates)
+            for(int lane = 0; lane < numLanes; ++lane)
+                text << "," << juce::String(juce::roundToInt(rate)) << (numLanes > 1 ? (lane == 0 ? " A" : " B") : "");
+        text << "\n";
+
+        const auto numColumns = grid.getNumRates() * numLanes;
+        for(int i = 0; i < grid.getNumPoints(); ++i)
+        {
+            text << juce::String(grid.freqs[static_cast<size_t>(i)], 2);
+            for(int column = 0; column < numColumns; ++column)
+                text << "," << juce::String(levels[static_cast<size_t>(column * grid.getNumPoints() + i)], 3);
+            text << "\n";
+        }
+
+        file.replaceWithText(text);
+    }
+
+    double getPercentile(std::vector<double> values, double percentile)
+    {
+        if(values.empty())
+            return 0;
+
+        auto index = static_cast<size_t>(percentile / 100.0 * static_cast<double>(values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return values[index];
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto options = parseOptions(juce::ArgumentList(argc, argv));
+    if(options.presets.isEmpty() || options.rates.empty() || options.numPoints < 2)
+        return fail("usage: PresetAnalyzer --presets <dir> [--pattern *] [--rates 44100,48000,96000] "
+                    "[--points 4096] [--threads <cores>] [--max-boost 18] [--headroom 6] "
+                    "[--max-cramping 3] [--list 20] [--report report.csv] [--curves <dir>]");
+
+    const juce::File root(options.presets);
+    if(! root.isDirectory())
+        return fail("can't find " + options.presets);
+
+    const juce::File curvesDirectory(options.curves);
+    if(options.curves.isNotEmpty())
+    {
+        if(! curvesDirectory.createDirectory())
+            return fail("can't write " + options.curves);
+    }
+
+    auto found = root.findChildFiles(juce::File::findFiles, true, options.pattern);
+    std::vector<juce::File> files(found.begin(), found.end());
+    std::sort(files.begin(), files.end());
+
+    // One processor, only for its parameters' ranges and defaults.
+    std::unique_ptr<ChainSettingsDecoder> decoder;
+    {
+        FiveBandEQAudioProcessor processor;
+        decoder = std::make_unique<ChainSettingsDecoder>(processor.apvts);
+    }
+
+    const Grid grid(options.rates, options.numPoints);
+    std::vector<Analysis> analyses(files.size());
+
+    RealtimeWorkerPool pool;
+    pool.setNumWorkers(juce::jmax(0, options.numThreads - 1));
+
+    auto analyseFile = [&](int index)
+    {
+        const auto& file = files[static_cast<size_t>(index)];
+        auto& analysis = analyses[static_cast<size_t>(index)];
+
+        juce::MemoryBlock state;
+        ChainSettings settings;
+        if(! file.loadFileAsData(state) || ! decoder->decode(state.getData(), static_cast<int>(state.getSize()), settings))
+            return;
+
+        std::vector<double> levels;
+        analysis = analyse(settings, grid, options, levels);
+
+        if(options.curves.isNotEmpty())
+        {
+            auto name = file.getRelativePathFrom(root).replaceCharacters("/\\", "__");
+            writeCurves(curvesDirectory.getChildFile(name).withFileExtension("csv"), grid,
+                        settings.stereoMode == Stereo_Linked ? 1 : 2, levels);
+        }
+    };
+
+    auto start = juce::Time::getHighResolutionTicks();
+    pool.run(static_cast<int>(files.size()), analyseFile);
+    const auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+    pool.setNumWorkers(0);
+
+    //==============================================================================
+    std::vector<double> peakGains, powerGains, crampings;
+    std::vector<size_t> outliers;
+    int numUndecodable = 0;
+
+    for(size_t i = 0; i < analyses.size(); ++i)
+    {
+        const auto& analysis = analyses[i];
+        if(! analysis.decoded)
+        {
+            ++numUndecodable;
+            continue;
+        }
+
+        peakGains.push_back(analysis.peakGain);
+        powerGains.push_back(analysis.powerGain);
+        crampings.push_back(analysis.cramping);
+
+        if(analysis.flags != 0)
+            outliers.push_back(i);
+    }
+
+    std::sort(outliers.begin(), outliers.end(), [&analyses](size_t a, size_t b) { return analyses[a].excess > analyses[b].excess; });
+
+    if(options.report.isNotEmpty())
+    {
+        juce::String text("preset,peak gain (dB),peak freq (Hz),peak rate (Hz),power gain (dB),"
+                          "cramping (dB),cramping freq (Hz),cramping rate (Hz),flags\n");
+
+        for(size_t i = 0; i < files.size(); ++i)
+        {
+            const auto& analysis = analyses[i];
+            text << files[i].getRelativePathFrom(root).quoted();
+            if(analysis.decoded)
+                text << "," << juce::String(analysis.peakGain, 2) << "," << juce::String(analysis.peakFreq, 1)
+                     << "," << juce::String(juce::roundToInt(analysis.peakRate)) << "," << juce::String(analysis.powerGain, 2)
+                     << "," << juce::String(analysis.cramping, 2) << "," << juce::String(analysis.crampingFreq, 1)
+                     << "," << juce::String(juce::roundToInt(analysis.crampingRate));
+            else
+                text << ",,,,,,,";
+            text << "," << getFlagNames(analysis) << "\n";
+        }
+
+        if(! juce::File(options.report).replaceWithText(text))
+            return fail("can't write " + options.report);
+    }
+
+    auto printStatistics = [](const char* label, const std::vector<double>& values)
+    {
+        std::cout << label << getPercentile(values, 50.0) << " / " << getPercentile(values, 99.0)
+                  << " / " << getPercentile(values, 100.0) << "\n";
+    };
+
+    std::cout << "presets           " << files.size() << "\n"
+              << "undecodable       " << numUndecodable << "\n"
+              << "time     (s)      " << seconds << "\n"
+              << "per preset (us)   " << 1.0e6 * seconds / juce::jmax<double>(1.0, static_cast<double>(files.size())) << "\n"
+              << "                  median / p99 / max\n";
+    printStatistics("peak gain (dB)    ", peakGains);
+    printStatistics("power gain (dB)   ", powerGains);
+    printStatistics("cramping (dB)     ", crampings);
+    std::cout << "outliers          " << outliers.size() << "\n";
+
+    for(size_t n = 0; n < juce::jmin(outliers.size(), static_cast<size_t>(juce::jmax(0, options.listLength))); ++n)
+    {
+        const auto i = outliers[n];
+        const auto& analysis = analyses[i];
+        std::cout << "  " << files[i].getRelativePathFrom(root)
+                  << ": peak " << juce::String(analysis.peakGain, 1) << " dB at " << juce::String(juce::roundToInt(analysis.peakFreq))
+                  << " Hz (" << juce::String(juce::roundToInt(analysis.peakRate)) << "), power " << juce::String(analysis.powerGain, 1)
+                  << " dB, cramping " << juce::String(analysis.cramping, 1) << " dB at " << juce::String(juce::roundToInt(analysis.crampingFreq))
+                  << " Hz (" << juce::String(juce::roundToInt(analysis.crampingRate)) << ") [" << getFlagNames(analysis) << "]\n";
+    }
+
+    std::cout << std::flush;
+    return outliers.empty() && numUndecodable == 0 ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+/*
+  ==============================================================================
+
+    Automation-storm stress benchmark.
+
+    Drives FiveBandEQAudioProcessor offline the way a host does while every
+    parameter is automated at once: each block all parameters get new random
+    values (cut slopes and band types included), blocks are optionally split
+    at random points as sample-accurate hosts do, and a second thread keeps
+    calling setStateInformation with random presets.
+
+    Every processBlock call is timed. The worst case and the 99.9th
+    percentile are reported against a real-time budget, and the exit code is
+    non-zero if either exceeds it, so the run can gate a CI job.
+
+    Usage:
+      StressBench [--sample-rate 48000] [--block-size 64] [--seconds 60]
+                  [--budget-fraction 0.5] [--state-interval-ms 20]
+                  [--split] [--seed 1] [--trace trace.json]
+                  [--kernels generic|avx2|avx-512]
+      StressBench --check-kernels [--seed 1]
+
+    --trace writes the processor's trace markers as Chrome trace-event JSON;
+    it needs a build with FIVEBANDEQ_ENABLE_TRACING=1.
+
+    --kernels runs the benchmark on the given kernel variant instead of the
+    best one this CPU supports. --check-kernels only compares every variant
+    the CPU supports with the generic kernels, prints the differences and
+    exits with a non-zero code if any variant is off.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+#include "../../../Source/TraceProfiler.h"
+#include "../../../Source/KernelDispatch.h"
+
+namespace
+{
+    struct Options
+    {
+        double sampleRate = 48000.0;
+        int blockSize = 64;
+        double seconds = 60.0;
+        double budgetFraction = 0.5;
+        int stateIntervalMs = 20;
+        bool splitBlocks = false;
+        juce::int64 seed = 1;
+        juce::String traceFile;
+        juce::String kernels;
+        bool checkKernels = false;
+    };
+
+    Options parseOptions(const juce::ArgumentList& args)
+    {
+        Options options;
+
+        auto read = [&args](const juce::String& name, auto& value)
+        {
+            if(args.containsOption(name))
+                value = static_cast<std::decay_t<decltype(value)>>(args.getValueForOption(name).getDoubleValue());
+        };
+
+        read("--sample-rate", options.sampleRate);
+        read("--block-size", options.blockSize);
+        read("--seconds", options.seconds);
+        read("--budget-fraction", options.budgetFraction);
+        read("--state-interval-ms", options.stateIntervalMs);
+        read("--seed", options.seed);
+        options.splitBlocks = args.containsOption("--split");
+        options.traceFile = args.getValueForOption("--trace");
+        options.kernels = args.getValueForOption("--kernels");
+        options.checkKernels = args.containsOption("--check-kernels");
+
+        return options;
+    }
+
+    void randomiseParameters(FiveBandEQAudioProcessor& processor, juce::Random& random)
+    {
+        // Hosts deliver automation through setValue on the audio thread, without notifying back.
+        for(auto* param : processor.getParameters())
+            param->setValue(random.nextFloat());
+    }
+
+    // Restores random presets until told to stop, like a host recalling snapshots mid-playback.
+    struct StateRestorer : juce::Thread
+    {
+        StateRestorer(FiveBandEQAudioProcessor& p, std::vector<juce::MemoryBlock> s, int interval)
+            : juce::Thread("State restorer"), processor(p), states(std::move(s)), intervalMs(interval) {}
+
+        void run() override
+        {
+            juce::Random random;
+            while(! threadShouldExit())
+            {
+                const auto& state = states[static_cast<size_t>(random.nextInt(static_cast<int>(states.size())))];
+                processor.setStateInformation(state.getData(), static_cast<int>(state.getSize()));
+                ++numRestores;
+                wait(intervalMs);
+            }
+        }
+
+        FiveBandEQAudioProcessor& processor;
+        std::vector<juce::MemoryBlock> states;
+        int intervalMs;
+        std::atomic<int> numRestores { 0 };
+    };
+
+    int checkKernels(juce::int64 seed)
+    {
+        std::cout << "kernels           " << getKernelVariantNames()[getBestKernelVariant()] << " is the best this CPU supports\n";
+
+        bool passed = true;
+        for(const auto& check : checkKernelVariants(seed))
+        {
+            std::cout << getKernelVariantNames()[check.variant] << "\n"
+                      << "  block error     " << check.blockError << " (generic " << check.genericBlockError << ")\n"
+                      << "  magnitude (dB)  " << check.magnitudeError << "\n"
+                      << "  spectrum        " << check.spectrumError << "\n"
+                      << "  " << (check.passed ? "PASS" : "FAIL") << "\n";
+            passed = passed && check.passed;
+        }
+
+        std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+        return passed ? 0 : 1;
+    }
+
+    double getPercentile(std::vector<double> values, double percentile)
+    {
+        auto index = static_cast<size_t>(percentile / 100.0 * static_cast<double>(values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return values[index];
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto options = parseOptions(juce::ArgumentList(argc, argv));
+
+    if(options.checkKernels)
+        return checkKernels(options.seed);
+
+    if(options.kernels.isNotEmpty())
+    {
+        auto variant = getKernelVariantNames().indexOf(options.kernels, true);
+        if(variant < 0 || ! isKernelVariantAvailable(static_cast<KernelVariant>(variant)))
+        {
+            std::cerr << "--kernels " << options.kernels << " isn't available on this build or CPU" << std::endl;
+            return 1;
+        }
+        setActiveKernelVariant(static_cast<KernelVariant>(variant));
+    }
+
+    const auto numBlocks = options.sampleRate > 0 && options.blockSize > 0
+                         ? static_cast<int>(options.seconds * options.sampleRate / options.blockSize) : 0;
+    if(numBlocks < 1)
+    {
+        std::cerr << "--seconds, --sample-rate and --block-size have to make at least one block" << std::endl;
+        return 1;
+    }
+
+    juce::Random random(options.seed);
+
+    FiveBandEQAudioProcessor processor;
+    processor.setPlayConfigDetails(2, 2, options.sampleRate, options.blockSize);
+    processor.prepareToPlay(options.sampleRate, options.blockSize);
+
+    // Build the presets up front so the restore thread only exercises setStateInformation.
+    std::vector<juce::MemoryBlock> states(32);
+    for(auto& state : states)
+    {
+        randomiseParameters(processor, random);
+        processor.getStateInformation(state);
+    }
+
+    juce::AudioBuffer<float> buffer(2, options.blockSize);
+    juce::MidiBuffer midi;
+
+    std::vector<double> blockTimesUs;
+    blockTimesUs.reserve(static_cast<size_t>(numBlocks) * (options.splitBlocks ? 4 : 1));
+
+    StateRestorer restorer(processor, states, options.stateIntervalMs);
+    if(options.stateIntervalMs > 0)
+        restorer.startThread();
+
+    const auto ticksToUs = 1.0e6 / static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+
+    auto process = [&](int numSamples)
+    {
+        // Fresh noise every call so denormals and silence shortcuts don't flatter the result.
+        for(int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        {
+            auto* data = buffer.getWritePointer(ch);
+            for(int i = 0; i < numSamples; ++i)
+                data[i] = random.nextFloat() * 2.f - 1.f;
+        }
+
+        juce::AudioBuffer<float> view(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), numSamples);
+
+        auto start = juce::Time::getHighResolutionTicks();
+        processor.processBlock(view, midi);
+        auto end = juce::Time::getHighResolutionTicks();
+
+        blockTimesUs.push_back(static_cast<double>(end - start) * ticksToUs);
+    };
+
+    for(int block = 0; block < numBlocks; ++block)
+    {
+        randomiseParameters(processor, random);
+
+        if(options.splitBlocks && options.blockSize > 1)
+        {
+            // Sample-accurate hosts split the block at each automation point.
+            auto split = 1 + random.nextInt(options.blockSize - 1);
+            process(split);
+            randomiseParameters(processor, random);
+            process(options.blockSize - split);
+        }
+        else
+        {
+            process(options.blockSize);
+        }
+    }
+
+    restorer.stopThread(2000);
+    processor.releaseResources();
+
+    if(options.traceFile.isNotEmpty())
+    {
+       #if FIVEBANDEQ_ENABLE_TRACING
+        TraceProfiler::getInstance().writeToFile(juce::File::getCurrentWorkingDirectory().getChildFile(options.traceFile));
+       #else
+        std::cerr << "--trace needs a build with FIVEBANDEQ_ENABLE_TRACING=1" << std::endl;
+       #endif
+    }
+
+    //==============================================================================
+    const auto budgetUs = options.budgetFraction * 1.0e6 * options.blockSize / options.sampleRate;
+    const auto worstUs = *std::max_element(blockTimesUs.begin(), blockTimesUs.end());
+    const auto p999Us = getPercentile(blockTimesUs, 99.9);
+    const auto p99Us = getPercentile(blockTimesUs, 99.0);
+    const auto meanUs = std::accumulate(blockTimesUs.begin(), blockTimesUs.end(), 0.0) / static_cast<double>(blockTimesUs.size());
+
+    const bool passed = worstUs <= budgetUs && p999Us <= budgetUs;
+
+    std::cout << "kernels           " << getKernelVariantNames()[getActiveKernelVariant()] << "\n"
+              << "blocks            " << blockTimesUs.size() << "\n"
+              << "state restores    " << restorer.numRestores.load() << "\n"
+              << "mean     (us)     " << meanUs << "\n"
+              << "p99      (us)     " << p99Us << "\n"
+              << "p99.9    (us)     " << p999Us << "\n"
+              << "worst    (us)     " << worstUs << "\n"
+              << "budget   (us)     " << budgetUs << "\n"
+              << (passed ? "PASS" : "FAIL") << std::endl;
+
+    return passed ? 0 : 1;
+}